@@ -1,6 +1,6 @@
 let namesData = {};
-let pollInterval = 5; // 5 seconds
-let timeoutId = null;
+let pollInterval = 5; // 5 seconds, fallback when /api/stream is down
+let pollTimer = null;
 
 async function fetchNames() {
     try {
@@ -19,21 +19,46 @@ async function fetchStatus() {
         // update data
         renderDashboard(data);
         updateFooter();
-
-        // // select the read_interval
-        // if (data.inverter && data.inverter.read_interval_ms) {
-        //     const newInterval = data.inverter.read_interval_ms / 1000; // seconds
-        //     if (newInterval !== pollInterval) {
-        //         pollInterval = newInterval;
-        //         schedulePoll();
-        //     }
-        // }
     } catch (e) {
         console.error('Failed to fetch status:', e);
         document.getElementById('lastUpdate').textContent = 'Connection error';
     }
 }
 
+function startPolling() {
+    if (!pollTimer) {
+        pollTimer = setInterval(fetchStatus, pollInterval * 1000);
+    }
+}
+
+function stopPolling() {
+    clearInterval(pollTimer);
+    pollTimer = null;
+}
+
+// New samples are pushed by the device as soon as they are read; poll
+// only while the stream is down, EventSource reconnects by itself
+function connectStream() {
+    if (!window.EventSource) {
+        startPolling();
+        return;
+    }
+
+    const source = new EventSource('/api/stream');
+    source.addEventListener('status', (e) => {
+        stopPolling();
+        renderDashboard(JSON.parse(e.data));
+        updateFooter();
+    });
+    source.addEventListener('event', (e) => {
+        showEvent(JSON.parse(e.data));
+    });
+    source.onerror = () => {
+        console.error('Status stream lost, polling');
+        startPolling();
+    };
+}
+
 function formatValue(val, key = '', sectionKey = '') {
     if (val === null || val === undefined)
         return '-';
@@ -202,7 +227,8 @@ function createCard(key, value, sectionKey) {
     const fieldMeta = sectionMeta[key] || {};
     const name = fieldMeta.name || key;
     const unit = fieldMeta.unit || '';
-    const desc = fieldMeta.description || '';
+    let desc = fieldMeta.description || '';
+    if (fieldMeta.register) desc += ` (register ${fieldMeta.register})`;
     
     const title = document.createElement('div');
     title.className = 'card-title';
@@ -274,12 +300,19 @@ function updateFooter() {
     document.getElementById('lastUpdate').textContent = `Last update: ${now}`;
 }
 
+// Grid, overload, load and fault changes, pushed the moment they are seen
+function showEvent(event) {
+    const time = event.time ? new Date(event.time * 1000) : new Date();
+    const name = event.type.replace('_', ' ');
+    const code = event.code ? ` (code ${event.code})` : '';
+    document.getElementById('lastEvent').textContent =
+        ` · ${name.charAt(0).toUpperCase() + name.slice(1)}${code} at ${time.toLocaleTimeString()}`;
+}
+
 async function init() {
     await fetchNames();
     await fetchStatus();
-    
-    // Set up update intervals, unit is in seconds with decimals
-    setInterval(fetchStatus, pollInterval * 1000);
+    connectStream();
 }
 
 window.addEventListener('DOMContentLoaded', init);
@@ -0,0 +1,83 @@
+"""
+PlatformIO pre-build script: gzip the dashboard in data/.
+
+Every file in data/ is compressed once per change into
+<build dir>/data_gz/<name>.gz, which becomes the SPIFFS image source for
+`pio run -t buildfs/uploadfs`, and into src/assets_data.h, the byte arrays
+the firmware serves when ASSETS_EMBEDDED is set in config.h.
+
+index.html references style.css and app.js with a ?v=<crc32> of their
+content, so the browser can cache them for good and only revalidates
+index.html. The firmware takes each ETag from the gzip trailer.
+"""
+
+import gzip
+import os
+import re
+import zlib
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+project_dir = env.subst("$PROJECT_DIR")  # noqa: F821
+data_dir = os.path.join(project_dir, "data")
+out_dir = os.path.join(env.subst("$BUILD_DIR"), "data_gz")  # noqa: F821
+header = os.path.join(project_dir, "src", "assets_data.h")
+
+
+def version_reference(m, contents):
+    """href="app.js" -> href="app.js?v=<crc32 of app.js>" for files in data/"""
+    name = m.group(2).decode()
+    if name not in contents:
+        return m.group(0)
+    return b'%s="%s?v=%08x"' % (m.group(1), m.group(2), zlib.crc32(contents[name]))
+
+
+def symbol(name):
+    return "asset_" + re.sub(r"\W", "_", name)
+
+
+def write_if_changed(path, data):
+    if os.path.exists(path):
+        with open(path, "rb") as f:
+            if f.read() == data:
+                return
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def build():
+    names = sorted(n for n in os.listdir(data_dir) if os.path.isfile(os.path.join(data_dir, n)))
+    contents = {}
+    for name in names:
+        with open(os.path.join(data_dir, name), "rb") as f:
+            contents[name] = f.read()
+
+    os.makedirs(out_dir, exist_ok=True)
+    lines = ["// Generated by extras/build_assets.py from data/, do not edit", ""]
+    table = []
+    total = packed_total = 0
+    for name in names:
+        data = contents[name]
+        if name.endswith(".html"):
+            data = re.sub(rb'(href|src)="([^"/?:]+)"', lambda m: version_reference(m, contents), data)
+        # mtime 0 keeps the output, and so the ETag, stable across builds
+        packed = gzip.compress(data, compresslevel=9, mtime=0)
+        write_if_changed(os.path.join(out_dir, name + ".gz"), packed)
+        total += len(data)
+        packed_total += len(packed)
+
+        lines.append("static const uint8_t %s[] PROGMEM = {" % symbol(name))
+        for i in range(0, len(packed), 16):
+            lines.append("  " + ", ".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+        lines.append("};")
+        table.append('  {"/%s", %s, sizeof(%s)},' % (name, symbol(name), symbol(name)))
+
+    lines += ["", "static const EmbeddedAsset embedded_assets[] = {"] + table + ["};", ""]
+    write_if_changed(header, "\n".join(lines).encode())
+    print("Assets: %d files, %d bytes, %d gzipped" % (len(names), total, packed_total))
+
+
+build()
+
+# SPIFFS images get the gzipped copies, the web server serves <path>.gz
+env.Replace(PROJECT_DATA_DIR=out_dir)  # noqa: F821
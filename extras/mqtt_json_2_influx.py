@@ -5,6 +5,8 @@ import sys
 import time
 import logging
 import json
+import math
+import struct
 import requests
 from datetime import datetime
 from threading import Thread, Event
@@ -20,6 +22,43 @@ logging.basicConfig(
 )
 logger = logging.getLogger(__name__)
 
+def decode_cbor(buf, pos=0):
+    """Decode the CBOR subset /api/status.cbor uses: unsigned ints, maps and floats.
+    Returns (value, next position)."""
+    initial = buf[pos]
+    major, info = initial >> 5, initial & 0x1f
+    pos += 1
+
+    if major == 7:
+        if info == 25:
+            return struct.unpack('>e', buf[pos:pos + 2])[0], pos + 2
+        if info == 26:
+            return struct.unpack('>f', buf[pos:pos + 4])[0], pos + 4
+        if info == 27:
+            return struct.unpack('>d', buf[pos:pos + 8])[0], pos + 8
+        if info == 22:
+            return None, pos
+        raise ValueError(f"Unsupported CBOR simple value {info}")
+
+    if info < 24:
+        arg = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        arg = int.from_bytes(buf[pos:pos + size], 'big')
+        pos += size
+    else:
+        raise ValueError(f"Unsupported CBOR argument {info}")
+
+    if major == 0:
+        return arg, pos
+    if major == 5:
+        result = {}
+        for _ in range(arg):
+            key, pos = decode_cbor(buf, pos)
+            result[key], pos = decode_cbor(buf, pos)
+        return result, pos
+    raise ValueError(f"Unsupported CBOR major type {major}")
+
 class DataBridge:
     def __init__(self, config_path):
         self.config = configparser.ConfigParser()
@@ -121,6 +160,10 @@ class DataBridge:
         try:
             self.http_url = self.config.get('http', 'url')
             self.http_poll_interval = self.config.getint('http', 'poll_interval', fallback=15)
+            # /api/status.cbor is keyed by field id, /api/fields names them
+            self.http_cbor = self.http_url.endswith('.cbor')
+            self.http_fields_url = self.http_url.rsplit('/', 1)[0] + '/fields'
+            self.http_fields = {}
             logger.info(f"HTTP source initialized: {self.http_url}")
         except Exception as e:
             logger.error(f"Failed to initialize HTTP: {e}")
@@ -182,6 +225,17 @@ class DataBridge:
 
             # Last part contains measurement.field
             last_part = parts[-1]
+
+            # Batched firmware payload: the whole /api/status json
+            if last_part == 'status':
+                self._process_json_data(json.loads(payload))
+                return
+            # Grid, overload and fault events and the online flag are not samples
+            if last_part == 'event':
+                logger.info(f"Inverter event: {payload}")
+                return
+            if last_part == 'online':
+                return
             if '.' not in last_part:
                 logger.warning(f"Invalid topic format (no dot): {topic}")
                 return
@@ -207,7 +261,10 @@ class DataBridge:
             try:
                 response = requests.get(self.http_url, timeout=10)
                 response.raise_for_status()
-                data = response.json()
+                if self.http_cbor:
+                    data = self._decode_status_cbor(response.content)
+                else:
+                    data = response.json()
 
                 # Check if data is valid
                 if data.get('inverter', {}).get('valid_info') != 1:
@@ -241,6 +298,30 @@ class DataBridge:
                 logger.error(f"Error polling HTTP endpoint: {e}")
                 self.stop_event.wait(self.http_poll_interval)
 
+    def _load_fields(self):
+        """Fetch the field id manifest of /api/status.cbor"""
+        response = requests.get(self.http_fields_url, timeout=10)
+        response.raise_for_status()
+        manifest = response.json()
+        self.http_fields = {f['id']: (f['section'], f['key']) for f in manifest['fields']}
+        logger.info(f"Loaded {len(self.http_fields)} field ids from {self.http_fields_url}")
+
+    def _decode_status_cbor(self, payload):
+        """Rebuild the /api/status sections from a CBOR status map"""
+        values, _ = decode_cbor(payload)
+        # Unknown ids mean the firmware changed, fetch the manifest again
+        if not self.http_fields or any(k not in self.http_fields for k in values if k != 0):
+            self._load_fields()
+
+        data = {'seq': values.get(0)}
+        for field_id, value in values.items():
+            if isinstance(value, float) and math.isnan(value):
+                continue
+            if field_id in self.http_fields:
+                section, key = self.http_fields[field_id]
+                data.setdefault(section, {})[key] = value
+        return data
+
     def _process_json_data(self, data, prefix=''):
         """Recursively process JSON data and write to InfluxDB"""
         for key, value in data.items():
@@ -0,0 +1,336 @@
+#!/usr/bin/env python3
+"""
+PowMr inverter Modbus RTU simulator over a pseudo-terminal.
+
+Answers as slave 5 with the 4501-4562 register block described in
+extras/registers-map.md, paced as if the bytes travelled over a real
+RS485 link at the configured baud rate plus a fixed turnaround latency.
+The firmware (or the native benchmark) talks to the pty symlink exactly
+as it would talk to Serial1 on the dongle.
+
+Register words are sent low byte first, like the inverter does; the
+firmware swaps them back with htons(). Writes to the settings registers
+5002-5033 (function 06) are range checked and show up in the 4535-4543
+registers that report them.
+"""
+
+import argparse
+import logging
+import os
+import random
+import select
+import sys
+import time
+import tty
+
+logging.basicConfig(
+    level=logging.INFO,
+    format='%(asctime)s - %(levelname)s - %(message)s'
+)
+logger = logging.getLogger(__name__)
+
+FIRST_REGISTER = 4501
+LAST_REGISTER = 4562
+
+# Values in engineering units times the register scale, matching the
+# sample json in README.md
+DEFAULT_REGISTERS = {
+    4501: 4,      # Operational mode: on AC
+    4502: 1224,   # AC input voltage, 0.1 V
+    4503: 607,    # AC input frequency, 0.1 Hz
+    4504: 883,    # PV voltage, 0.1 V
+    4505: 404,    # PV power, W
+    4506: 274,    # Battery voltage, 0.1 V
+    4507: 100,    # Battery SoC, %
+    4508: 0,      # Battery charge current, A
+    4509: 0,      # Battery discharge current, A
+    4510: 1215,   # Load voltage, 0.1 V
+    4511: 607,    # Load frequency, 0.1 Hz
+    4512: 352,    # Load VA
+    4513: 341,    # Load power, W
+    4514: 9,      # Load percent
+    4515: 9,      # Load percent
+    4516: 0x0000, # Binary flags
+    4530: 0,      # Error code
+    4535: 0x2c01, # Settings binary flags
+    4536: 1,      # Charger source priority
+    4537: 1,      # Output source priority
+    4538: 0,      # AC input voltage range
+    4540: 60,     # Target output frequency
+    4541: 60,     # Max total charging current
+    4542: 120,    # Target output voltage
+    4543: 30,     # Max utility charging current
+    4544: 230,    # Back to utility source voltage, 0.1 V
+    4545: 270,    # Back to battery source voltage, 0.1 V
+    4546: 288,    # Bulk charging voltage, 0.1 V
+    4547: 276,    # Floating charging voltage, 0.1 V
+    4548: 220,    # Low cutoff voltage, 0.1 V
+    4549: 288,    # Battery equalization voltage, 0.1 V
+    4550: 60,     # Battery equalized time
+    4551: 120,    # Battery equalized timeout
+    4552: 30,     # Equalization interval
+    4553: 0x2200, # Binary flags: AC active
+    4554: 0x8100, # Binary flags: AC active
+    4555: 13,     # Charger status
+    4557: 44,     # Temperature, C
+}
+
+# Registers that change while the grid is down, see --outage-period
+OUTAGE_REGISTERS = {
+    4501: 3,      # Operational mode: on battery
+    4502: 0,
+    4503: 0,
+    4509: 14,     # Battery discharge current, A
+    4553: 0x4100, # Binary flags: on battery, load enabled
+    4554: 0x0001, # Binary flags: on battery
+}
+
+# Writable settings: write register -> (register reporting it, bit for an
+# on/off setting or 0 for the whole word, accepted values)
+WRITE_FIRST = 5002
+WRITE_LAST = 5033
+WRITE_REGISTERS = {
+    5002: (4535, 0x0100, range(2)),   # Buzzer alarm
+    5004: (4535, 0x0400, range(2)),   # Backlight
+    5005: (4535, 0x0800, range(2)),   # Restart on overload
+    5006: (4535, 0x1000, range(2)),   # Restart on overheat
+    5007: (4535, 0x2000, range(2)),   # Beep on primary source fail
+    5008: (4535, 0x4000, range(2)),   # Return to default screen
+    5009: (4535, 0x8000, range(2)),   # Overload bypass
+    5010: (4535, 0x0001, range(2)),   # Record fault code
+    5017: (4536, 0, range(4)),        # Charger source priority
+    5018: (4537, 0, range(3)),        # Output source priority
+    5019: (4538, 0, range(2)),        # AC input voltage range
+    5022: (4541, 0, range(10, 81)),   # Max total charge current
+    5024: (4543, 0, (2, 10, 20, 30, 40, 50, 60)),  # Utility charge current
+}
+
+# Registers that wander a little on every read so consecutive samples differ
+NOISY_REGISTERS = {
+    4502: (1180, 1260, 3),
+    4504: (700, 950, 5),
+    4505: (300, 500, 8),
+    4506: (262, 282, 1),
+    4512: (300, 420, 6),
+    4513: (290, 400, 6),
+}
+
+
+def crc16(data):
+    """Modbus RTU CRC16"""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def with_crc(frame):
+    crc = crc16(frame)
+    return bytes(frame) + bytes([crc & 0xFF, crc >> 8])
+
+
+class Inverter:
+    """Register file and Modbus request handling"""
+
+    def __init__(self, args):
+        self.slave = args.slave
+        self.max_regs = args.max_regs
+        self.oversize = args.oversize
+        self.drop_rate = args.drop_rate
+        self.corrupt_rate = args.corrupt_rate
+        self.outage_period = args.outage_period
+        self.fault = args.fault
+        self.ignore_writes = args.ignore_writes
+        self.started = time.monotonic()
+        self.grid = True
+        self.noise = not args.no_noise
+        self.registers = {r: 0 for r in range(FIRST_REGISTER, LAST_REGISTER + 1)}
+        self.registers.update(DEFAULT_REGISTERS)
+        self.requests = 0
+
+    def _wander(self):
+        for reg, (low, high, step) in NOISY_REGISTERS.items():
+            if not self.grid and reg in OUTAGE_REGISTERS:
+                continue
+            value = self.registers[reg] + random.randint(-step, step)
+            self.registers[reg] = max(low, min(high, value))
+
+    def _update_grid(self):
+        grid = int((time.monotonic() - self.started) / self.outage_period) % 2 == 0
+        if grid == self.grid:
+            return
+        self.grid = grid
+        logger.info("Grid restored" if grid else "Grid lost")
+        for reg, value in OUTAGE_REGISTERS.items():
+            self.registers[reg] = DEFAULT_REGISTERS.get(reg, 0) if grid else value
+        self.registers[4530] = 0 if grid else self.fault
+
+    def _exception(self, function, code):
+        return with_crc([self.slave, function | 0x80, code])
+
+    def _read_holding(self, address, qty):
+        if qty == 0 or qty > 125:
+            return self._exception(0x03, 0x03)
+        if qty > self.max_regs:
+            if self.oversize == 'silent':
+                return None
+            return self._exception(0x03, 0x03)
+        if address < FIRST_REGISTER or address + qty - 1 > LAST_REGISTER:
+            return self._exception(0x03, 0x02)
+
+        if self.noise:
+            self._wander()
+        if self.outage_period:
+            self._update_grid()
+
+        payload = []
+        for reg in range(address, address + qty):
+            value = self.registers[reg] & 0xFFFF
+            payload += [value & 0xFF, value >> 8]
+        return with_crc([self.slave, 0x03, len(payload)] + payload)
+
+    def _write_single(self, address, value):
+        if not WRITE_FIRST <= address <= WRITE_LAST:
+            return self._exception(0x06, 0x02)
+        if address in WRITE_REGISTERS:
+            reg, mask, accepted = WRITE_REGISTERS[address]
+            if value not in accepted:
+                return self._exception(0x06, 0x03)
+            if not self.ignore_writes and mask:
+                self.registers[reg] = (self.registers[reg] | mask) if value else (self.registers[reg] & ~mask)
+            elif not self.ignore_writes:
+                self.registers[reg] = value
+        logger.info(f"Write {address} = {value}" + (", not applied" if self.ignore_writes else ""))
+
+        # Acknowledged with an echo of the request
+        return with_crc([self.slave, 0x06, address >> 8, address & 0xFF, value >> 8, value & 0xFF])
+
+    def handle(self, frame):
+        """Return the reply to a request frame, or None to stay silent"""
+        if len(frame) < 4 or crc16(frame[:-2]) != frame[-2] | (frame[-1] << 8):
+            logger.warning(f"Bad CRC, ignoring: {frame.hex()}")
+            return None
+        if frame[0] != self.slave:
+            return None
+
+        self.requests += 1
+        if self.drop_rate and random.random() < self.drop_rate:
+            logger.debug("Dropping request on purpose")
+            return None
+
+        function = frame[1]
+        if function == 0x03:
+            address = (frame[2] << 8) | frame[3]
+            qty = (frame[4] << 8) | frame[5]
+            reply = self._read_holding(address, qty)
+        elif function == 0x06:
+            address = (frame[2] << 8) | frame[3]
+            value = (frame[4] << 8) | frame[5]
+            reply = self._write_single(address, value)
+        else:
+            reply = self._exception(function, 0x01)
+
+        if reply and self.corrupt_rate and random.random() < self.corrupt_rate:
+            # Line noise: one flipped bit past the header, caught by the CRC
+            logger.debug("Corrupting reply on purpose")
+            reply = bytearray(reply)
+            reply[random.randrange(3, len(reply))] ^= 1 << random.randrange(8)
+            reply = bytes(reply)
+        return reply
+
+
+class PtyLink:
+    """Pseudo-terminal with RS485 timing"""
+
+    def __init__(self, args):
+        self.baud = args.baud
+        self.latency = args.latency_ms / 1000.0
+        self.master, slave = os.openpty()
+        tty.setraw(slave)
+        self.slave_name = os.ttyname(slave)
+        self.link = args.link
+
+        if os.path.islink(self.link):
+            os.unlink(self.link)
+        os.symlink(self.slave_name, self.link)
+        # Keep the slave side open so the pty survives client reconnects
+        self.slave_fd = slave
+
+    def wire_time(self, nbytes):
+        # 8N1: start + 8 data + stop, plus the 3.5 char inter-frame gap
+        return (nbytes + 3.5) * 10.0 / self.baud
+
+    def read_frame(self):
+        """Collect one request frame, delimited by the RTU silent interval"""
+        frame = bytearray()
+        gap = max(self.wire_time(0), 0.002)
+        while True:
+            timeout = None if not frame else gap
+            ready, _, _ = select.select([self.master], [], [], timeout)
+            if not ready:
+                return bytes(frame)
+            frame += os.read(self.master, 256)
+            if len(frame) == 8 and frame[1] in (0x03, 0x06):
+                return bytes(frame)
+
+    def send(self, request_len, reply):
+        time.sleep(self.wire_time(request_len) + self.latency + self.wire_time(len(reply)))
+        os.write(self.master, reply)
+
+    def close(self):
+        if os.path.islink(self.link):
+            os.unlink(self.link)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='PowMr inverter Modbus RTU simulator')
+    parser.add_argument('--link', default='/tmp/powmr', help='symlink to the pty slave (default /tmp/powmr)')
+    parser.add_argument('--slave', type=int, default=5, help='Modbus slave id (default 5)')
+    parser.add_argument('--baud', type=int, default=2400, help='simulated line speed (default 2400)')
+    parser.add_argument('--latency-ms', type=float, default=50.0, help='inverter turnaround time (default 50 ms)')
+    parser.add_argument('--max-regs', type=int, default=125, help='largest read the inverter accepts (default 125)')
+    parser.add_argument('--oversize', choices=['exception', 'silent'], default='exception',
+                        help='answer to reads above --max-regs (default exception)')
+    parser.add_argument('--drop-rate', type=float, default=0.0, help='fraction of requests left unanswered')
+    parser.add_argument('--corrupt-rate', type=float, default=0.0, help='fraction of replies with a bit flipped')
+    parser.add_argument('--outage-period', type=float, default=0.0,
+                        help='seconds of grid, then as many without, repeating (default: grid always on)')
+    parser.add_argument('--fault', type=int, default=0, help='fault code shown during outages (default 0)')
+    parser.add_argument('--ignore-writes', action='store_true',
+                        help='acknowledge setting writes without applying them')
+    parser.add_argument('--no-noise', action='store_true', help='keep measurement registers constant')
+    parser.add_argument('--seed', type=int, help='random seed for repeatable runs')
+    parser.add_argument('-v', '--verbose', action='store_true', help='log every request')
+    args = parser.parse_args()
+
+    if args.verbose:
+        logger.setLevel(logging.DEBUG)
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    inverter = Inverter(args)
+    link = PtyLink(args)
+    logger.info(f"Simulating slave {args.slave} at {args.baud} baud, {args.latency_ms} ms latency "
+                f"on {link.link} -> {link.slave_name}")
+
+    try:
+        while True:
+            frame = link.read_frame()
+            if not frame:
+                continue
+            logger.debug(f"<- {frame.hex()}")
+            reply = inverter.handle(frame)
+            if reply is None:
+                continue
+            link.send(len(frame), reply)
+            logger.debug(f"-> {reply.hex()}")
+    except KeyboardInterrupt:
+        logger.info(f"Stopping after {inverter.requests} requests")
+    finally:
+        link.close()
+
+
+if __name__ == '__main__':
+    main()
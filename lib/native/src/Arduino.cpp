@@ -0,0 +1,190 @@
+// Arduino core shim for the host-native build
+
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <chrono>
+#include <thread>
+
+// Console output goes to stderr so stdout stays clean for tool output
+HardwareSerial Serial(STDERR_FILENO);
+HardwareSerial Serial1(-1);
+
+static const auto boot_time = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - boot_time).count();
+}
+
+unsigned long micros() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - boot_time).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+// ==================== PRINT ====================
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  return write((const uint8_t *)buf, min((size_t)len, sizeof(buf) - 1));
+}
+
+size_t Print::print(long n, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", n);
+  return write(buf);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", n);
+  return write(buf);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+// ==================== HARDWARE SERIAL ====================
+
+static speed_t baudToSpeed(unsigned long baud) {
+  switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    default: return B115200;
+  }
+}
+
+void HardwareSerial::setPort(const char *path) {
+  strncpy(port, path, sizeof(port) - 1);
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+  (void)config;
+  (void)rxPin;
+  (void)txPin;
+
+  if (console) {
+    return;
+  }
+
+  end();
+  if (port[0] == 0) {
+    fprintf(stderr, "HardwareSerial: no port set, call setPort() first\n");
+    return;
+  }
+
+  fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) {
+    perror(port);
+    return;
+  }
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baudToSpeed(baud));
+    cfsetospeed(&tio, baudToSpeed(baud));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  tcflush(fd, TCIOFLUSH);
+}
+
+void HardwareSerial::end() {
+  if (!console && fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  peeked = -1;
+}
+
+int HardwareSerial::available() {
+  if (fd < 0 || console) {
+    return 0;
+  }
+  int n = 0;
+  if (ioctl(fd, FIONREAD, &n) < 0) {
+    return 0;
+  }
+  return n + (peeked >= 0 ? 1 : 0);
+}
+
+int HardwareSerial::read() {
+  if (peeked >= 0) {
+    int c = peeked;
+    peeked = -1;
+    return c;
+  }
+  if (fd < 0 || console) {
+    return -1;
+  }
+  uint8_t c;
+  return ::read(fd, &c, 1) == 1 ? c : -1;
+}
+
+int HardwareSerial::peek() {
+  if (peeked < 0) {
+    peeked = read();
+  }
+  return peeked;
+}
+
+void HardwareSerial::flush() {
+  if (fd >= 0 && !console) {
+    tcdrain(fd);
+  }
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (fd < 0) {
+    return 0;
+  }
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::write(fd, buffer + done, size - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,115 @@
+// Arduino core shim for the host-native build
+// Only what the acquisition, parsing and energy modules use
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+// Serial configuration and pins (ignored on the host)
+#define SERIAL_8N1 0x800001c
+#define GPIO_NUM_16 16
+#define GPIO_NUM_17 17
+
+// Timing
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// FreeRTOS task notifications: the host build is single threaded, the
+// Modbus master polls instead of waiting for RX events
+typedef void *TaskHandle_t;
+inline int xTaskNotifyGive(TaskHandle_t task) { (void)task; return 1; }
+
+inline uint32_t esp_random() { return (uint32_t)rand(); }
+
+// Same as arduino-esp32: both arguments must have the same type
+using std::min;
+using std::max;
+
+template <typename T, typename L, typename H>
+inline T constrain(T x, L low, H high) {
+  return x < low ? low : (x > high ? high : x);
+}
+
+// Print: formatting front-end shared by every output
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T>
+  size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+// Stream: byte oriented input on top of Print
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+};
+
+// HardwareSerial: console on stderr or a tty/pty device
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(int console_fd) : fd(console_fd), console(console_fd >= 0) {}
+
+  // Host only: device opened by the next begin(), e.g. the simulator pty
+  void setPort(const char *path);
+
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+  void end();
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush() override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  operator bool() const { return fd >= 0; }
+
+private:
+  int fd;
+  bool console;
+  int peeked = -1;
+  char port[128] = {0};
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif // NATIVE_ARDUINO_H
@@ -0,0 +1,19 @@
+// ESPAsyncWebServer shim for the host-native build
+// Declaration only, so globals.h can be shared with the firmware
+
+#ifndef NATIVE_ESPASYNCWEBSERVER_H
+#define NATIVE_ESPASYNCWEBSERVER_H
+
+#include <Arduino.h>
+
+class AsyncWebServer {
+public:
+  explicit AsyncWebServer(uint16_t port) { (void)port; }
+};
+
+class AsyncEventSource {
+public:
+  explicit AsyncEventSource(const char *url) { (void)url; }
+};
+
+#endif // NATIVE_ESPASYNCWEBSERVER_H
@@ -0,0 +1,18 @@
+// IPAddress shim for the host-native build
+
+#ifndef NATIVE_IPADDRESS_H
+#define NATIVE_IPADDRESS_H
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+  uint8_t operator[](int index) const { return octets[index]; }
+
+private:
+  uint8_t octets[4] = {0, 0, 0, 0};
+};
+
+#endif // NATIVE_IPADDRESS_H
@@ -0,0 +1,50 @@
+// Preferences shim for the host-native build
+
+#include "Preferences.h"
+
+std::map<std::string, std::map<std::string, double>> Preferences::store;
+
+bool Preferences::begin(const char *name, bool ro) {
+  space = name;
+  readOnly = ro;
+  started = true;
+  return true;
+}
+
+void Preferences::end() {
+  started = false;
+}
+
+bool Preferences::isKey(const char *key) {
+  return started && store[space].count(key) > 0;
+}
+
+bool Preferences::remove(const char *key) {
+  if (!started || readOnly) {
+    return false;
+  }
+  return store[space].erase(key) > 0;
+}
+
+bool Preferences::clear() {
+  if (!started || readOnly) {
+    return false;
+  }
+  store[space].clear();
+  return true;
+}
+
+size_t Preferences::put(const char *key, double value) {
+  if (!started || readOnly) {
+    return 0;
+  }
+  store[space][key] = value;
+  return sizeof(value);
+}
+
+double Preferences::get(const char *key, double defaultValue) {
+  if (!isKey(key)) {
+    return defaultValue;
+  }
+  return store[space][key];
+}
@@ -0,0 +1,40 @@
+// Preferences shim for the host-native build
+// In-memory key/value store per namespace, lost when the process exits
+
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false);
+  void end();
+
+  bool isKey(const char *key);
+  bool remove(const char *key);
+  bool clear();
+
+  size_t putFloat(const char *key, float value) { return put(key, value); }
+  size_t putUChar(const char *key, uint8_t value) { return put(key, value); }
+  size_t putUShort(const char *key, uint16_t value) { return put(key, value); }
+  size_t putUInt(const char *key, uint32_t value) { return put(key, value); }
+
+  float getFloat(const char *key, float defaultValue = NAN) { return get(key, defaultValue); }
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return get(key, defaultValue); }
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return get(key, defaultValue); }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return get(key, defaultValue); }
+
+private:
+  size_t put(const char *key, double value);
+  double get(const char *key, double defaultValue);
+
+  static std::map<std::string, std::map<std::string, double>> store;
+  std::string space;
+  bool started = false;
+  bool readOnly = false;
+};
+
+#endif // NATIVE_PREFERENCES_H
@@ -0,0 +1,11 @@
+// WebSerial shim for the host-native build
+// Log output simply goes to the console
+
+#ifndef NATIVE_WEBSERIAL_H
+#define NATIVE_WEBSERIAL_H
+
+#include <Arduino.h>
+
+#define WebSerial Serial
+
+#endif // NATIVE_WEBSERIAL_H
@@ -0,0 +1,108 @@
+// WiFiClient shim for the host-native build
+
+#include "WiFiClient.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+int WiFiClient::connect(const char *host, uint16_t port, int32_t timeout_ms) {
+  stop();
+
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  struct addrinfo hints = {}, *res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, service, &hints, &res) != 0) {
+    return 0;
+  }
+
+  fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd >= 0) {
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int rc = ::connect(fd, res->ai_addr, res->ai_addrlen);
+    if (rc < 0 && errno == EINPROGRESS) {
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      int err = 0;
+      socklen_t len = sizeof(err);
+      rc = (poll(&pfd, 1, timeout_ms) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) ? 0 : -1;
+    }
+    // Blocking writes, like lwIP's
+    fcntl(fd, F_SETFL, 0);
+    if (rc < 0) {
+      stop();
+    }
+  }
+  freeaddrinfo(res);
+  return fd >= 0;
+}
+
+uint8_t WiFiClient::connected() {
+  if (fd < 0) {
+    return 0;
+  }
+  char c;
+  ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+void WiFiClient::stop() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void WiFiClient::setNoDelay(bool nodelay) {
+  int flag = nodelay;
+  if (fd >= 0) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+}
+
+int WiFiClient::available() {
+  int n = 0;
+  if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0) {
+    return 0;
+  }
+  return n;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size) {
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t n = recv(fd, buf, size, MSG_DONTWAIT);
+  return n < 0 ? -1 : (int)n;
+}
+
+int WiFiClient::peek() {
+  uint8_t c;
+  if (fd < 0 || recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size) {
+  if (fd < 0) {
+    return 0;
+  }
+  ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+  return n < 0 ? 0 : (size_t)n;
+}
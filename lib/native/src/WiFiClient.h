@@ -0,0 +1,32 @@
+// WiFiClient shim for the host-native build
+// Blocking TCP client on POSIX sockets, enough for the MQTT publisher
+
+#ifndef NATIVE_WIFICLIENT_H
+#define NATIVE_WIFICLIENT_H
+
+#include <Arduino.h>
+
+class WiFiClient : public Stream {
+public:
+  ~WiFiClient() { stop(); }
+
+  int connect(const char *host, uint16_t port, int32_t timeout_ms);
+  uint8_t connected();
+  void stop();
+  void setNoDelay(bool nodelay);
+
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size);
+  int peek() override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+
+  operator bool() { return connected(); }
+
+private:
+  int fd = -1;
+};
+
+#endif // NATIVE_WIFICLIENT_H
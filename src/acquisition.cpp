@@ -0,0 +1,78 @@
+// Acquisition task implementation
+// sendRequest() blocks for the whole Modbus read, so it runs in its own
+// task pinned to ACQ_TASK_CORE and publishes every sample as a snapshot.
+
+#include "acquisition.h"
+#include "globals.h"
+#include "utils.h"
+#include "modbus.h"
+#include "snapshot.h"
+#include "history.h"
+#include "events.h"
+#include "watchdog.h"
+#include "settings.h"
+#include "log.h"
+#include "perf.h"
+#include "scheduler.h"
+
+#define LOG_MODULE LOG_MODBUS
+
+static TaskHandle_t acquisitionHandle = NULL;
+static Scheduler jobs("acquisition");
+static int8_t readJob = -1;
+
+// One acquisition cycle: read, publish, then follow the new read interval
+static void readCycle() {
+  PERF_SCOPE(PERF_CYCLE);
+  sendRequest();
+
+  const Snapshot *snap;
+  {
+    PERF_SCOPE(PERF_PUBLISH);
+    snap = &publishSnapshot();
+  }
+  {
+    PERF_SCOPE(PERF_HISTORY);
+    historyAdd(*snap);
+  }
+  eventsUpdate(*snap);
+
+  jobs.setPeriod(readJob, dynamic_read_interval * 1000);
+}
+
+// A change of the status flags gets a full read of its own, off the grid of
+// the periodic ones
+static void watchdogCheck() {
+  if (watchdogPoll(jobs.dueIn(readJob))) {
+    jobs.after("outage_read", 0, readCycle);
+  }
+}
+
+// Read the inverter on multiples of dynamic_read_interval seconds
+static void acquisitionTask(void *param) {
+  mbus.attachTask(xTaskGetCurrentTaskHandle());
+
+  readJob = jobs.every("read", dynamic_read_interval * 1000, readCycle);
+  if (WATCHDOG_INTERVAL_MS) {
+    jobs.every("watchdog", WATCHDOG_INTERVAL_MS, watchdogCheck);
+  }
+
+  for (;;) {
+    // Requests queued by other tasks go out between cycles
+    settingsLoop();
+    mbus.poll();
+
+    uint32_t idle = jobs.run();
+    vTaskDelay(pdMS_TO_TICKS(min(idle, (uint32_t)10)));
+  }
+}
+
+// Start the acquisition task
+void acquisitionSetup() {
+  publishSnapshot();
+
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", ACQ_TASK_STACK, NULL,
+                          ACQ_TASK_PRIORITY, &acquisitionHandle, ACQ_TASK_CORE);
+
+  LOGI("Acquisition task started on core %d", ACQ_TASK_CORE);
+}
@@ -0,0 +1,12 @@
+// Acquisition task header
+// Runs the Modbus reads off the Arduino loop
+
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <Arduino.h>
+
+// Start the acquisition task
+void acquisitionSetup();
+
+#endif // ACQUISITION_H
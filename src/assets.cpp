@@ -0,0 +1,162 @@
+// Static assets implementation
+// The ETag of a gzipped file is the CRC-32 of its content from the gzip
+// trailer, so it is known without reading or hashing the file. index.html
+// is revalidated on every load; it references style.css and app.js with a
+// content hash, so those are cached for good.
+
+#include <SPIFFS.h>
+#include <FS.h>
+#include "assets.h"
+#include "config.h"
+#include "json_utils.h"
+#include "gzip.h"
+#include "log.h"
+#ifdef ASSETS_EMBEDDED
+  #include "assets_data.h"
+#endif
+
+#define LOG_MODULE LOG_WEB
+
+#define CACHE_REVALIDATE "no-cache"
+#define CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#define NAMES_JSON_MAX 12288
+
+struct Asset {
+  const char *path;
+  const char *type;
+  const char *cacheControl;
+  const uint8_t *data;      // Embedded gzip, NULL when served from SPIFFS
+  size_t len;
+  char etag[11];            // "crc32", empty when the file is not gzipped
+};
+
+static Asset assets[] = {
+  {"/index.html", "text/html", CACHE_REVALIDATE},
+  {"/style.css", "text/css", CACHE_IMMUTABLE},
+  {"/app.js", "application/javascript", CACHE_IMMUTABLE},
+};
+
+#define ASSETS (sizeof(assets) / sizeof(assets[0]))
+
+// names.json never changes within a firmware, gzipped once on demand
+static uint8_t *namesGz = NULL;
+static size_t namesLen = 0;
+static char namesEtag[11];
+
+static void etagFromTrailer(char *etag, const uint8_t *trailer) {
+  uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+  snprintf(etag, 11, "\"%08x\"", (unsigned)crc);
+}
+
+void assetsSetup() {
+  for (uint8_t i = 0; i < ASSETS; i++) {
+    Asset &a = assets[i];
+    uint8_t trailer[8];
+
+    #ifdef ASSETS_EMBEDDED
+      for (const EmbeddedAsset &e : embedded_assets) {
+        if (strcmp(e.path, a.path) == 0 && e.len >= 18) {
+          a.data = e.data;
+          a.len = e.len;
+          memcpy(trailer, e.data + e.len - 8, 8);
+          etagFromTrailer(a.etag, trailer);
+        }
+      }
+    #else
+      String gz = String(a.path) + ".gz";
+      File f = SPIFFS.open(gz, "r");
+      if (f && f.size() >= 18 && f.seek(f.size() - 8) && f.read(trailer, 8) == 8) {
+        etagFromTrailer(a.etag, trailer);
+      } else {
+        LOGW("Asset not gzipped, serving it plain: %s", a.path);
+      }
+      if (f) {
+        f.close();
+      }
+    #endif
+  }
+}
+
+static AsyncWebServerResponse *notModified(AsyncWebServerRequest *request, const char *etag) {
+  const AsyncWebHeader *match = request->getHeader("If-None-Match");
+  if (!etag[0] || !match || match->value() != etag) {
+    return NULL;
+  }
+  return request->beginResponse(304);
+}
+
+void sendAsset(AsyncWebServerRequest *request, const char *path) {
+  const Asset *a = NULL;
+  for (uint8_t i = 0; i < ASSETS; i++) {
+    if (strcmp(assets[i].path, path) == 0) {
+      a = &assets[i];
+    }
+  }
+  if (!a) {
+    request->send(404, "text/plain", "Not Found");
+    return;
+  }
+
+  AsyncWebServerResponse *response = notModified(request, a->etag);
+  if (!response) {
+    if (a->data) {
+      response = request->beginResponse(200, a->type, a->data, a->len);
+      response->addHeader("Content-Encoding", "gzip");
+    } else {
+      // Picks <path>.gz and adds Content-Encoding itself when only that exists
+      response = request->beginResponse(SPIFFS, a->path, a->type);
+    }
+  }
+  if (a->etag[0]) {
+    response->addHeader("ETag", a->etag);
+    response->addHeader("Cache-Control", a->cacheControl);
+  }
+  request->send(response);
+}
+
+// Render and compress names.json, false when out of memory
+static bool packNames() {
+  char *json = (char *)malloc(NAMES_JSON_MAX);
+  uint8_t *gz = (uint8_t *)malloc(NAMES_JSON_MAX);
+  uint16_t *hash = (uint16_t *)malloc(GZIP_HASH_BYTES);
+  bool ok = json && gz && hash;
+  if (ok) {
+    JsonWriter w(json, NAMES_JSON_MAX);
+    namesJson(w);
+    size_t len = w.full() ? 0 : gzipCompress((const uint8_t *)json, w.length(), gz, NAMES_JSON_MAX, hash);
+    ok = len > 0;
+    if (ok) {
+      uint8_t *fit = (uint8_t *)realloc(gz, len);
+      namesGz = fit ? fit : gz;
+      namesLen = len;
+      etagFromTrailer(namesEtag, namesGz + len - 8);
+      gz = NULL;
+    }
+  }
+  free(json);
+  free(gz);
+  free(hash);
+  return ok;
+}
+
+void sendNames(AsyncWebServerRequest *request) {
+  if (!namesGz && !packNames()) {
+    // Still correct, just uncached
+    request->send(request->beginChunkedResponse("application/json",
+      [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        JsonWriter w((char *)buffer, maxLen, index);
+        namesJson(w);
+        return w.length();
+      }));
+    return;
+  }
+
+  AsyncWebServerResponse *response = notModified(request, namesEtag);
+  if (!response) {
+    response = request->beginResponse(200, "application/json", namesGz, namesLen);
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("ETag", namesEtag);
+  response->addHeader("Cache-Control", CACHE_REVALIDATE);
+  request->send(response);
+}
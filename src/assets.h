@@ -0,0 +1,27 @@
+// Static assets header
+// Dashboard files gzipped at build time by extras/build_assets.py, served
+// from the firmware image or SPIFFS with ETags and cache headers
+
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Gzipped file compiled into the firmware (assets_data.h)
+struct EmbeddedAsset {
+  const char *path;
+  const uint8_t *data;
+  size_t len;
+};
+
+// Find the assets and take their ETags from the gzip trailers, after SPIFFS
+void assetsSetup();
+
+// Serve the asset at path: 304 on an ETag match, else the gzipped body
+void sendAsset(AsyncWebServerRequest *request, const char *path);
+
+// Serve names.json, rendered and gzipped on the first request
+void sendNames(AsyncWebServerRequest *request);
+
+#endif // ASSETS_H
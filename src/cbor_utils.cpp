@@ -0,0 +1,110 @@
+// CBOR utilities implementation
+// The status document is one flat map: STATUS_FIELD_SEQ and every field id
+// of the status fields table to its value. Integers use the shortest
+// encoding, floats are single precision. /api/fields maps ids to names.
+
+#include "cbor_utils.h"
+#include "log.h"
+#include "perf.h"
+
+#define LOG_MODULE LOG_WEB
+
+#define CBOR_UINT 0
+#define CBOR_MAP 5
+#define CBOR_FLOAT32 0xFA
+
+void CborWriter::byte(uint8_t b) {
+    if (len < size) {
+        buf[len++] = b;
+    } else {
+        overflow = true;
+    }
+}
+
+// Major type and argument, in the shortest form
+void CborWriter::head(uint8_t major, uint32_t v) {
+    major <<= 5;
+    if (v < 24) {
+        byte(major | v);
+    } else if (v <= 0xFF) {
+        byte(major | 24);
+        byte(v);
+    } else if (v <= 0xFFFF) {
+        byte(major | 25);
+        byte(v >> 8);
+        byte(v);
+    } else {
+        byte(major | 26);
+        byte(v >> 24);
+        byte(v >> 16);
+        byte(v >> 8);
+        byte(v);
+    }
+}
+
+void CborWriter::map(uint32_t entries) {
+    head(CBOR_MAP, entries);
+}
+
+void CborWriter::u32(uint32_t v) {
+    head(CBOR_UINT, v);
+}
+
+void CborWriter::f32(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    byte(CBOR_FLOAT32);
+    byte(bits >> 24);
+    byte(bits >> 16);
+    byte(bits >> 8);
+    byte(bits);
+}
+
+void CborWriter::field(const Snapshot &snap, const StatusField &f) {
+    const uint8_t *p = (const uint8_t *)&snap + f.offset;
+
+    u32(f.id);
+    switch (f.type) {
+        case FIELD_FLOAT: {
+            float v;
+            memcpy(&v, p, sizeof(v));
+            f32(v);
+            break;
+        }
+        case FIELD_U8:
+            u32(*p);
+            break;
+        case FIELD_U16: {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            u32(v);
+            break;
+        }
+        case FIELD_U32: {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            u32(v);
+            break;
+        }
+    }
+}
+
+size_t statusCbor(const Snapshot &snap, uint8_t *buf, size_t size) {
+    PERF_SCOPE(PERF_STATUS_CBOR);
+
+    CborWriter w(buf, size);
+
+    w.map(STATUS_FIELDS + 1);
+    w.u32(STATUS_FIELD_SEQ);
+    w.u32(snap.seq);
+    for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+        w.field(snap, status_fields[i]);
+    }
+
+    if (w.full()) {
+        LOGE("CBOR status too big for buffer");
+        return 0;
+    }
+
+    return w.length();
+}
@@ -0,0 +1,38 @@
+// CBOR utilities header
+// Compact status document for machine consumers, keyed by field id
+
+#ifndef CBOR_UTILS_H
+#define CBOR_UTILS_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+#include "status_fields.h"
+
+// Append-only CBOR (RFC 8949) writer into a caller buffer, never allocates
+class CborWriter {
+public:
+  CborWriter(uint8_t *buf, size_t size) : buf(buf), size(size) {}
+
+  void map(uint32_t entries);
+  void u32(uint32_t v);
+  void f32(float v);
+  void field(const Snapshot &snap, const StatusField &f);
+
+  size_t length() const { return len; }
+  bool full() const { return overflow; }
+
+private:
+  void head(uint8_t major, uint32_t v);
+  void byte(uint8_t b);
+
+  uint8_t *buf;
+  size_t size;
+  size_t len = 0;
+  bool overflow = false;
+};
+
+// Serialize a sample as a map of field id to value, returns the length or 0
+// if it did not fit
+size_t statusCbor(const Snapshot &snap, uint8_t *buf, size_t size);
+
+#endif // CBOR_UTILS_H
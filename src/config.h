@@ -5,14 +5,28 @@
 #define CONFIG_H
 
 /********* Configurable flags *************/
-#define WEBSERIAL 1
-#define VERBOSE_SERIAL 1
+#define WEBSERIAL 1                     // Log to WebSerial as well as Serial
 // #define DEBUG_AC 1
 // #define DEBUG_DC 1
 // #define DEBUG_INVERTER 1
 
 #define MONITOR_SERIAL_SPEED 9600
 #define VERSION  3.0
+#define WIFI_CHECK_INTERVAL (3*60)      // Seconds between reconnect checks
+
+// Logging: level of every module at boot, LEVEL_OFF to LEVEL_DEBUG. Change
+// it at runtime with /api/loglevel or the WebSerial command
+// "log <module|all> <level>".
+#define LOG_LEVEL LEVEL_INFO
+#define LOG_BUFFER_BYTES 4096           // Messages waiting for the drain task, oldest dropped when full
+#define LOG_LINE_MAX 160                // Longer messages are truncated
+#define LOG_TASK_CORE 1                 // Away from acquisition
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_STACK 3072
+
+// Profiler: latency histograms of the acquisition and serialization stages
+// at /api/perf, about 4.6 KB of RAM. Comment out to compile the timers out.
+#define PERF_ENABLED 1
 
 // Preferences save thresholds
 #define SAVE_THRESHOLD_PV 5.0       // 5 Wh
@@ -31,13 +45,100 @@ const float MAXIMUM_VOLTAGE = 28.8;   // V
 #define AUTONOMY_WINDOW_MINUTES 5.0      // Time window for averaging (minutes)
 
 // Modbus configuration
+#define MBUS_BAUD 2400
+#define MBUS_SLAVE_ID 5
+#define MBUS_FIRST_REGISTER 4501
 #define MBUS_REGISTERS 61 // Words uint16, starting from 4501 to 4562
-#define CHUNK_SIZE 3
+#define CHUNK_SIZE_MIN 3              // Known good on every inverter seen so far
+#define CHUNK_SIZE_MAX MBUS_REGISTERS // Whole block in one transaction
+#define CHUNK_REGROW_CYCLES 720       // Good reads before trying a bigger chunk again
 #define RETRY_COUNT 4
-#define CHUNK_DELAY_US 10
+#define EVENT_RING_SIZE 32            // Grid, overload, load and fault events kept for /api/events
+#define LINK_MIN_RATIO 0.25           // Link success ratio below which the read interval stops stretching
+#define SETTINGS_POLL_INTERVAL (5*60) // Seconds between reads of the settings group
+#define WATCHDOG_INTERVAL_MS 800      // Outage watchdog poll of 4553-4554 between full reads, 0 disables it
+#define WATCHDOG_TIMEOUT_MS 500       // Per poll, not retried: the next poll is the retry
+#define SETTING_WRITE_JOBS 8          // Setting writes kept for /api/settings, pending ones included
+#define SETTING_WRITE_INTERVAL 10     // Seconds before the same setting can be written again
+
+// Acquisition task
+#define ACQ_TASK_CORE 0
+#define ACQ_TASK_PRIORITY 1
+#define ACQ_TASK_STACK 8192
 
 // Dynamic read interval
 #define INITIAL_READ_INTERVAL 5.0 // 5 seconds initial
+#define READ_INTERVAL_MIN 2.0     // Seconds, also keeps the history and sample log spans sane
+#define READ_INTERVAL_MAX 30.0
+#define READ_DUTY_TARGET 0.5      // Bus share of the full reads, the rest for the watchdog and writes
+#define READ_TIME_WINDOW 20       // Good reads the p95 read time is taken over
+#define READ_INTERVAL_HYSTERESIS 0.1   // Speed up only for a 10% shorter interval...
+#define READ_INTERVAL_HOLD 5           // ...asked for this many reads in a row
+#define READ_INTERVAL_DECISIONS 8      // Interval changes kept for /api/modbus
+
+// Status payload buffer, two of them are kept
+#define STATUS_JSON_MAX 2048
+
+// Reconnect delay suggested to /api/stream clients
+#define STREAM_RETRY_MS 5000
+
+// In-RAM history of these /api/status fields ("section.key"), each one
+// takes 2 bytes per raw point and 6 per aggregated point
+#define HISTORY_FIELDS "ac.output_watts", "pv.pv_power", "inverter.soc"
+#define HISTORY_RAW_SPAN (30*60)            // Every sample for 30 min...
+#define HISTORY_RAW_POINTS ((int)(HISTORY_RAW_SPAN / READ_INTERVAL_MIN))   // ...at the shortest interval
+#define HISTORY_TIER1_PERIOD 60             // 1 min min/avg/max...
+#define HISTORY_TIER1_POINTS (24*60)        // ...for 24 h
+#define HISTORY_TIER2_PERIOD (15*60)        // 15 min min/avg/max...
+#define HISTORY_TIER2_POINTS (7*24*4)       // ...for 7 days
+
+// Sample log on SPIFFS: these fields ("section.key", at most 10) of every
+// valid sample, in 32 byte records
+#define SAMPLE_LOG_FIELDS "ac.input_voltage", "ac.output_watts", "dc.voltage", "dc.charge_current", \
+                          "dc.discharge_current", "pv.pv_power", "inverter.soc", "inverter.temp", "inverter.op_mode"
+#define SAMPLE_LOG_BATCH 8                  // Records per flash write, one 256 byte SPIFFS page
+#define SAMPLE_LOG_FLUSH_INTERVAL (2*60)    // Seconds, also the most a power cut loses
+#define SAMPLE_LOG_SEGMENT_SIZE (32*1024)
+#define SAMPLE_LOG_MAX_SIZE (512*1024)      // Oldest segments are deleted past this
+#define SAMPLE_LOG_MAX_SEGMENTS 32
+
+// MQTT publisher, uncomment MQTT_ENABLED and set MQTT_HOST to publish every
+// sample to a broker. Credentials are in wifi_creds.h.
+// #define MQTT_ENABLED 1
+#define MQTT_HOST "192.168.1.100"
+#define MQTT_PORT 1883
+#define MQTT_TOPIC_PREFIX "/powmr/"       // Topics are <prefix><section>.<key>
+#define MQTT_BATCH 0                      // 1: the status json on <prefix>status, 0: a topic per field
+#define MQTT_QOS 0                        // 0 or 1
+#define MQTT_RETAIN 1
+#define MQTT_REFRESH_INTERVAL (5*60)      // Seconds, unchanged values are published again this often
+#define MQTT_QUEUE_BYTES 8192             // Outbound queue, the oldest messages are dropped when full
+#define MQTT_KEEPALIVE 60                 // Seconds
+#define MQTT_RECONNECT_INTERVAL 10        // Seconds between connection attempts
+#define MQTT_CONNECT_TIMEOUT_MS 3000
+#define MQTT_TASK_CORE 1
+#define MQTT_TASK_PRIORITY 1
+#define MQTT_TASK_STACK 4096
+
+// InfluxDB writer, uncomment INFLUX_ENABLED to write line protocol straight
+// to an InfluxDB 2 server (plain HTTP) instead of through the Python bridge.
+// The API token is in wifi_creds.h.
+// #define INFLUX_ENABLED 1
+#define INFLUX_HOST "192.168.1.100"
+#define INFLUX_PORT 8086
+#define INFLUX_PATH "/api/v2/write?org=home&bucket=powmr&precision=s"
+#define INFLUX_BATCH_SAMPLES 6            // Samples per POST
+#define INFLUX_BATCH_SECONDS 60           // Most a sample waits for its batch
+#define INFLUX_GZIP 1                     // Compress bodies, about 6x smaller
+#define INFLUX_SPOOL_BYTES (24*1024)      // Spool of packed samples, ~10 min at 2 s, oldest dropped when full
+#define INFLUX_SAMPLE_MAX 1536            // Line protocol of one sample, rendered when its batch is built
+#define INFLUX_BODY_MAX (8*1024)          // One POST body, twice this is allocated
+#define INFLUX_RETRY_INTERVAL 30          // Seconds after a failed POST
+#define INFLUX_TIMEOUT_MS 5000
+#define INFLUX_TASK_CORE 1
+#define INFLUX_TASK_PRIORITY 1
+#define INFLUX_TASK_STACK 4096
+#define NTP_SERVER "pool.ntp.org"         // Line protocol timestamps need the wall clock
 
 // Serial pins for Modbus
 #define TXD2   GPIO_NUM_17  // TXD2
@@ -46,6 +147,10 @@ const float MAXIMUM_VOLTAGE = 28.8;   // V
 // SPIFFS
 #define FORMAT_SPIFFS_IF_FAILED true
 
+// Dashboard files, gzipped by extras/build_assets.py. Embedded in the
+// firmware image; comment out to serve them from SPIFFS (pio run -t uploadfs).
+#define ASSETS_EMBEDDED 1
+
 // Battery voltage range
 #define BATT_MAX_VOLTAGE 28.8
 #define BATT_MIN_VOLTAGE 23.0
@@ -0,0 +1,37 @@
+// Credentials implementation
+// The one translation unit that includes wifi_creds.h
+
+#include "credentials.h"
+#include "wifi_creds.h"
+
+const char *wifiSsid() {
+  return c_ssid;
+}
+
+const char *wifiPassword() {
+  return c_password;
+}
+
+const char *apSsid() {
+  return s_ssid;
+}
+
+const char *apPassword() {
+  return s_password;
+}
+
+const char *deviceHostname() {
+  return hostname;
+}
+
+const char *mqttUser() {
+  return mqtt_user;
+}
+
+const char *mqttPassword() {
+  return mqtt_password;
+}
+
+const char *influxToken() {
+  return influx_token;
+}
@@ -0,0 +1,24 @@
+// Credentials header
+// The values of wifi_creds.h, which only credentials.cpp includes: a module
+// gets the one it asks for instead of a copy of every secret.
+
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+// Client WiFi and AP fallback
+const char *wifiSsid();
+const char *wifiPassword();
+const char *apSsid();
+const char *apPassword();
+
+// mDNS, OTA and MQTT client id
+const char *deviceHostname();
+
+// MQTT broker login, empty for none
+const char *mqttUser();
+const char *mqttPassword();
+
+// InfluxDB API token with write access to the bucket in INFLUX_PATH
+const char *influxToken();
+
+#endif // CREDENTIALS_H
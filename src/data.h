@@ -58,6 +58,8 @@ struct InverterData {
     4: b0100: AC cargando
    */
    uint16_t charger;
+   uint16_t charger_source_priority;  // 4536, settings menu 16
+   uint16_t output_source_priority;   // 4537, settings menu 1
    /* Mapping in progress
     10: b1010: Descargando desde Batería, no AC, no PV _chargers_off_?
     11: b1011: AC off, PV on (charging from PV) charge in progress _MPPT_ACTIVE ?
@@ -78,6 +80,36 @@ struct InverterData {
    float energy_source_batt = 0.0;
    float energy_source_pv = 0.0;
    unsigned int autonomy = AUTONOMY_MAX_DAYS * 24 * 60;  // Autonomy in minutes
+   uint16_t fault_code = 0;           // 4530, 0 when there is none
+   uint16_t status_4516 = 0;          // Status words as read, bits below
+   uint16_t status_4553 = 0;
+   uint16_t status_4554 = 0;
+   byte ac_active = 0;                // Decoded from the status words
+   byte on_battery = 0;
+   byte load_on = 0;
+   byte overload = 0;
+};
+
+// Status word bits, see extras/registers-map.md. Several report the same
+// state; any of them set counts.
+#define STATUS_4516_OVERLOAD 0x0100
+#define STATUS_4553_ON_BATTERY 0x0100
+#define STATUS_4553_AC_ACTIVE 0x2200
+#define STATUS_4553_LOAD_OFF 0x1000
+#define STATUS_4554_ON_BATTERY 0x0001
+#define STATUS_4554_AC_ACTIVE 0x8100
+
+// Block of registers polled at its own rate
+#define REG_GROUPS 4
+struct RegisterGroup {
+  const char *name;
+  uint16_t first;            // Offset in mbusData, register MBUS_FIRST_REGISTER + first
+  uint16_t count;
+  unsigned long period_ms;   // 0: every cycle
+  uint64_t last_read;        // millis64() of the last good read
+  unsigned int updated;      // uptime() of the last good read
+  uint32_t reads;            // Good reads so far
+  bool refresh;              // Read on the next cycle whatever the period
 };
 
 #endif // DATA_H
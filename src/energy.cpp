@@ -4,27 +4,15 @@
 #include "energy.h"
 #include "globals.h"
 #include "utils.h"
+#include "log.h"
+#include "perf.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
+#define LOG_MODULE LOG_ENERGY
 
 // Generic energy accumulation function
-void updateEnergy(float &energy, float power, unsigned long &lastMillis, bool &firstCall) {
-  unsigned long currentMillis = millis();
-  unsigned long deltaMillis;
-
-  if (currentMillis < lastMillis) {
-    deltaMillis = (0xFFFFFFFF - lastMillis) + currentMillis + 1;
-  } else {
-    deltaMillis = currentMillis - lastMillis;
-  }
+void updateEnergy(float &energy, float power, uint64_t &lastMillis, bool &firstCall) {
+  uint64_t currentMillis = millis64();
+  uint64_t deltaMillis = currentMillis - lastMillis;
 
   if (firstCall) {
     firstCall = false;
@@ -46,19 +34,19 @@ void updateEnergy(float &energy, float power, unsigned long &lastMillis, bool &f
 // Update battery energy based on voltage and current
 void updateBatteryEnergy(float voltage, float chargeCurrent, float dischargeCurrent) {
   static bool firstRun = 1;
-  static unsigned long lastUpdateMillis = 0;
+  static uint64_t lastUpdateMillis = 0;
   
   if (voltage <= MINIMUM_VOLTAGE) {
     inverter.battery_energy = 0.0;
     inverter.gas_gauge = 0.0;
-    sprintln("Battery depleted - Reset to 0%");
+    LOGI("Battery depleted - Reset to 0%%");
     return;
   }
 
   if (voltage >= MAXIMUM_VOLTAGE) {
     inverter.battery_energy = MAXIMUM_ENERGY;
     inverter.gas_gauge = 100.0;
-    sprintln("Battery full - Reset to 100%");
+    LOGI("Battery full - Reset to 100%%");
     return;
   }
 
@@ -75,15 +63,15 @@ void updateBatteryEnergy(float voltage, float chargeCurrent, float dischargeCurr
 
 // Update PV energy produced
 void updatePVEnergy(float pvVoltage, float pvCurrent, float pvPower) {
-  static unsigned long lastPvMillis = 0;
+  static uint64_t lastPvMillis = 0;
   static bool firstPvCall = true;
-  static unsigned long nightStartMillis = 0;
+  static uint64_t nightStartMillis = 0;
   static bool isNight = false;
   static bool sixHourDarknessPassed = false;
   static bool sunriseDetected = false;
   static float previousPvVoltage = 0.0;
 
-  unsigned long currentMillis = millis();
+  uint64_t currentMillis = millis64();
   
   if (pvVoltage <= 30) {
     // Night time (PV voltage below threshold)
@@ -93,16 +81,11 @@ void updatePVEnergy(float pvVoltage, float pvCurrent, float pvPower) {
       sixHourDarknessPassed = false;
       sunriseDetected = false;
     } else {
-      unsigned long nightDuration;
-      if (currentMillis < nightStartMillis) {
-        nightDuration = (0xFFFFFFFF - nightStartMillis) + currentMillis + 1;
-      } else {
-        nightDuration = currentMillis - nightStartMillis;
-      }
+      uint64_t nightDuration = currentMillis - nightStartMillis;
 
       if (nightDuration >= (6*3600000) && !sixHourDarknessPassed) {
         sixHourDarknessPassed = true;
-        Serial.println("Night detected (6h darkness) - Ready for sunrise reset");
+        LOGI("Night detected (6h darkness) - Ready for sunrise reset");
       }
     }
 
@@ -114,14 +97,14 @@ void updatePVEnergy(float pvVoltage, float pvCurrent, float pvPower) {
     if (isNight) {
       if (previousPvVoltage <= 30 && pvVoltage > 30) {
         sunriseDetected = true;
-        sprint("==> Sunrise detected");
+        LOGI("Sunrise detected");
         
         if (sixHourDarknessPassed) {
           dc.pv_energy_produced = 0.0;
           sixHourDarknessPassed = false;
-          Serial.println("Sunrise after 6h darkness - PV energy reset to 0");
+          LOGI("Sunrise after 6h darkness - PV energy reset to 0");
         } else {
-          sprint("Sunrise before 6h darkness - keeping energy data");
+          LOGI("Sunrise before 6h darkness - keeping energy data");
         }
       }
       isNight = false;
@@ -161,21 +144,9 @@ void calculateAutonomy() {
 
     inverter.autonomy = min(minutes_remaining, max_minutes);
 
-    #ifdef VERBOSE_SERIAL
-      sprint("Autonomy EWMA (α=");
-      sprint(autonomy_alpha, 3);
-      sprint(") - Eff: ");
-      sprint(autonomy_efficiency_ewma, 1);
-      sprint("%, AC Watts: ");
-      sprint(autonomy_watts_ewma, 1);
-      sprint(", DC Watts: ");
-      sprint(dc_watts, 1);
-      sprint(", Hours left: ");
-      sprint(hours_remaining, 1);
-      sprint(" (");
-      sprint(inverter.autonomy);
-      sprintln(" min)");
-    #endif
+    LOGD("Autonomy EWMA (α=%.3f) - Eff: %.1f%%, AC Watts: %.1f, DC Watts: %.1f, Hours left: %.1f (%u min)",
+         autonomy_alpha, autonomy_efficiency_ewma, autonomy_watts_ewma, dc_watts, hours_remaining,
+         inverter.autonomy);
   } else {
     inverter.autonomy = AUTONOMY_MAX_DAYS * 24 * 60;
   }
@@ -191,15 +162,8 @@ void loadEnergyData() {
     inverter.gas_gauge = prefs.getFloat("gas_gauge", 0.0);
     inverter.energy_spent_ac = prefs.getFloat("ac_energy", 0.0);
 
-    sprintln("==> Loaded energy data from Preferences:");
-    sprint("  PV energy: ");
-    sprintln(dc.pv_energy_produced);
-    sprint("  Battery energy: ");
-    sprintln(inverter.battery_energy);
-    sprint("  Gas gauge: ");
-    sprintln(inverter.gas_gauge);
-    sprint("  AC energy spent: ");
-    sprintln(inverter.energy_spent_ac);
+    LOGI("Loaded energy data from Preferences: PV %.2f Wh, battery %.2f Wh, gas gauge %.2f%%, AC spent %.2f Wh",
+         dc.pv_energy_produced, inverter.battery_energy, inverter.gas_gauge, inverter.energy_spent_ac);
   } else {
     dc.pv_energy_produced = 0.0;
     inverter.energy_spent_ac = 0.0;
@@ -214,11 +178,8 @@ void loadEnergyData() {
       inverter.battery_energy = 0.0;
     }
 
-    sprintln("First boot - Initialized energy data with defaults:");
-    sprint("  Battery energy (from voltage): ");
-    sprintln(inverter.battery_energy);
-    sprint("  Gas gauge: ");
-    sprintln(inverter.gas_gauge);
+    LOGI("First boot - Initialized energy data with defaults: battery %.2f Wh (from voltage), gas gauge %.2f%%",
+         inverter.battery_energy, inverter.gas_gauge);
   }
 
   prefs.end();
@@ -257,6 +218,7 @@ void saveEnergyData(bool force) {
   }
 
   if (should_save || force) {
+    PERF_SCOPE(PERF_NVS_SAVE);
     prefs.begin("energy_data", false);
 
     prefs.putFloat("pv_energy", dc.pv_energy_produced);
@@ -271,8 +233,20 @@ void saveEnergyData(bool force) {
     last_gg = inverter.gas_gauge;
     last_ac = inverter.energy_spent_ac;
 
-    #ifdef VERBOSE_SERIAL
-      sprintln("==> Energy data saved to Preferences");
-    #endif
+    LOGD("Energy data saved to Preferences");
   }
 }
+
+// Save energy data from a published sample, usable outside the acquisition
+// task: it has its own Preferences handle and never touches the globals
+void saveEnergySnapshot(const Snapshot &snap) {
+  Preferences snapPrefs;
+  snapPrefs.begin("energy_data", false);
+
+  snapPrefs.putFloat("pv_energy", snap.dc.pv_energy_produced);
+  snapPrefs.putFloat("batt_energy", snap.inverter.battery_energy);
+  snapPrefs.putFloat("gas_gauge", snap.inverter.gas_gauge);
+  snapPrefs.putFloat("ac_energy", snap.inverter.energy_spent_ac);
+
+  snapPrefs.end();
+}
@@ -5,9 +5,10 @@
 #define ENERGY_H
 
 #include <Arduino.h>
+#include "snapshot.h"
 
 // Generic energy accumulation
-void updateEnergy(float &energy, float power, unsigned long &lastMillis, bool &firstCall);
+void updateEnergy(float &energy, float power, uint64_t &lastMillis, bool &firstCall);
 
 // Battery energy calculations
 void updateBatteryEnergy(float voltage, float chargeCurrent, float dischargeCurrent);
@@ -21,5 +22,6 @@ void calculateAutonomy();
 // Persistence
 void loadEnergyData();
 void saveEnergyData(bool force = false);
+void saveEnergySnapshot(const Snapshot &snap);
 
 #endif // ENERGY_H
@@ -0,0 +1,129 @@
+// Inverter events implementation
+// EVENT_RING_SIZE newest events, the oldest one is overwritten. A reader
+// whose cursor fell out of the ring resumes at the oldest event left.
+
+#include "events.h"
+#include "config.h"
+#include "log.h"
+#include "utils.h"
+#include <time.h>
+
+#define LOG_MODULE LOG_EVENTS
+
+#ifdef NATIVE
+  #define EVENT_LOCK()
+  #define EVENT_UNLOCK()
+#else
+  static portMUX_TYPE eventMux = portMUX_INITIALIZER_UNLOCKED;
+  #define EVENT_LOCK() portENTER_CRITICAL(&eventMux)
+  #define EVENT_UNLOCK() portEXIT_CRITICAL(&eventMux)
+#endif
+
+static const char *event_names[EVENT_TYPES] = {
+  "grid_lost", "grid_restored", "overload", "overload_cleared",
+  "fault", "fault_cleared", "load_off", "load_on",
+};
+
+static Event ring[EVENT_RING_SIZE];
+static uint32_t latest = 0;   // Event i lives in ring[(i - 1) % EVENT_RING_SIZE]
+
+// State of the previous valid sample
+static bool baseline = false;
+static bool acActive;
+static bool overload;
+static bool loadOn;
+static uint16_t faultCode;
+
+static void raise(uint32_t seq, unsigned int up, EventType type, uint16_t code) {
+  time_t now = time(nullptr);
+
+  EVENT_LOCK();
+  Event &e = ring[latest % EVENT_RING_SIZE];
+  e.id = latest + 1;
+  e.seq = seq;
+  e.uptime = up;
+  e.time = now > 1600000000 ? now : 0;
+  e.type = type;
+  e.code = code;
+  latest++;
+  EVENT_UNLOCK();
+
+  if (type == EVENT_GRID_RESTORED || type == EVENT_OVERLOAD_CLEARED ||
+      type == EVENT_FAULT_CLEARED || type == EVENT_LOAD_ON) {
+    LOGI("Event %s, code %u", eventName(type), code);
+  } else {
+    LOGW("Event %s, code %u", eventName(type), code);
+  }
+}
+
+// Raise an event for each flag that changed since the last call
+static void update(bool ac, bool over, bool load, uint16_t fault, uint32_t seq, unsigned int up) {
+  if (baseline) {
+    if (acActive != ac) {
+      raise(seq, up, ac ? EVENT_GRID_RESTORED : EVENT_GRID_LOST, 0);
+    }
+    if (overload != over) {
+      raise(seq, up, over ? EVENT_OVERLOAD : EVENT_OVERLOAD_CLEARED, 0);
+    }
+    if (loadOn != load) {
+      raise(seq, up, load ? EVENT_LOAD_ON : EVENT_LOAD_OFF, 0);
+    }
+    if (faultCode != fault) {
+      if (faultCode) {
+        raise(seq, up, EVENT_FAULT_CLEARED, faultCode);
+      }
+      if (fault) {
+        raise(seq, up, EVENT_FAULT, fault);
+      }
+    }
+  }
+
+  baseline = true;
+  acActive = ac;
+  overload = over;
+  loadOn = load;
+  faultCode = fault;
+}
+
+void eventsUpdate(const Snapshot &snap) {
+  // A failed read says nothing about the inverter
+  if (!snap.inverter.valid_info) {
+    return;
+  }
+
+  const InverterData &inv = snap.inverter;
+  update(inv.ac_active, inv.overload, inv.load_on, inv.fault_code, snap.seq, snap.uptime);
+}
+
+void eventsWatchdog(const InverterData &inv) {
+  // Nothing to compare with before the first full read
+  if (!baseline) {
+    return;
+  }
+
+  // Overload and fault are not in the watchdog words, keep them as they were
+  update(inv.ac_active, overload, inv.load_on, faultCode, snapshotSeq() + 1, uptime());
+}
+
+bool eventRead(uint32_t after, Event &out) {
+  EVENT_LOCK();
+  uint32_t oldest = latest > EVENT_RING_SIZE ? latest - EVENT_RING_SIZE + 1 : 1;
+  uint32_t id = max(after + 1, oldest);
+  bool found = id <= latest;
+  if (found) {
+    out = ring[(id - 1) % EVENT_RING_SIZE];
+  }
+  EVENT_UNLOCK();
+  return found;
+}
+
+uint32_t eventsLatest() {
+  EVENT_LOCK();
+  uint32_t id = latest;
+  EVENT_UNLOCK();
+  return id;
+}
+
+const char *eventName(uint8_t type) {
+  return type < EVENT_TYPES ? event_names[type] : "?";
+}
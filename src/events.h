@@ -0,0 +1,51 @@
+// Inverter events header
+// Edge-triggered events from the decoded status flags and fault code,
+// raised on the sample where the state changes and kept in a bounded ring.
+// Readers follow the ring with their own cursor: /api/stream and MQTT push
+// each event as soon as it is raised, /api/events lists the ring.
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+
+enum EventType : uint8_t {
+  EVENT_GRID_LOST,
+  EVENT_GRID_RESTORED,
+  EVENT_OVERLOAD,
+  EVENT_OVERLOAD_CLEARED,
+  EVENT_FAULT,            // New non-zero fault code
+  EVENT_FAULT_CLEARED,    // Code is the one that cleared
+  EVENT_LOAD_OFF,
+  EVENT_LOAD_ON,
+  EVENT_TYPES,
+};
+
+struct Event {
+  uint32_t id;            // Increases by one per event, from 1
+  uint32_t seq;           // Sample that showed the change, or the one the watchdog started
+  unsigned int uptime;    // uptime() of that sample
+  uint32_t time;          // Unix time, 0 before the clock was set
+  EventType type;
+  uint16_t code;          // Fault code, 0 for the other types
+};
+
+// Compare a published sample with the previous valid one and raise events,
+// acquisition task only. The first valid sample only sets the baseline.
+void eventsUpdate(const Snapshot &snap);
+
+// Same from the status words the outage watchdog just read, acquisition
+// task only. The events are raised before the full read that follows, with
+// its seq; that read then only confirms them.
+void eventsWatchdog(const InverterData &inv);
+
+// Oldest event still in the ring with an id above after; false if none
+bool eventRead(uint32_t after, Event &out);
+
+// Id of the newest event, 0 before the first
+uint32_t eventsLatest();
+
+const char *eventName(uint8_t type);
+
+#endif // EVENTS_H
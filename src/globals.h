@@ -7,30 +7,32 @@
 #include "data.h"
 #include "config.h"
 #include <Preferences.h>
-#include <ModbusMaster.h>
+#include "modbus_rtu.h"
+#include "scheduler.h"
 #include <ESPAsyncWebServer.h>
 #include <IPAddress.h>
 
-// Print macros - defined here but implemented via includes in .cpp files
-// The actual sprint/sprintln macros are defined in main.cpp and other .cpp files
-
 // Preferences for persistent storage
 extern Preferences prefs;
 
-// Modbus node
-extern ModbusMaster node;
+// Modbus master
+extern ModbusRtu mbus;
 extern uint16_t mbusData[MBUS_REGISTERS + 1];
 
+// Adaptive chunk size: current and largest the inverter accepted
+extern uint8_t chunk_size;
+extern uint8_t chunk_size_max;
+
 // Web server
 extern AsyncWebServer server;
+extern AsyncEventSource events;
 extern IPAddress myIp;
 
 // WiFi status: 0 = client, 1 = AP
 extern bool wifiMode;
 
-// Timing variables
-extern unsigned long lastSendRequestTime;
-extern unsigned long lastWifiCheckTime;
+// Timed jobs of loop()
+extern Scheduler loopJobs;
 
 // Dynamic read interval
 extern float dynamic_read_interval;
@@ -0,0 +1,170 @@
+// Gzip implementation
+// Greedy LZ77 over a 4096 entry hash of 3 byte prefixes, coded with the
+// fixed Huffman tables of RFC 1951 (block type 1), so no tables are sent.
+// Line protocol and json compress 5 to 10 times with it.
+
+#include "gzip.h"
+
+#define HASH_BITS 12
+static_assert((1 << HASH_BITS) == GZIP_HASH_ENTRIES, "hash table size");
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_DISTANCE 32768
+
+static const uint16_t lengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                    8193, 12289, 16385, 24577};
+static const uint8_t distExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+class BitWriter {
+public:
+  BitWriter(uint8_t *out, size_t size, size_t len) : out(out), size(size), len(len) {}
+
+  // Extra bits and headers, least significant bit first
+  void bits(uint32_t value, uint8_t n) {
+    acc |= value << count;
+    count += n;
+    while (count >= 8) {
+      byte(acc & 0xFF);
+      acc >>= 8;
+      count -= 8;
+    }
+  }
+
+  // Huffman codes, most significant bit first
+  void code(uint32_t value, uint8_t n) {
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < n; i++) {
+      reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    bits(reversed, n);
+  }
+
+  void flush() {
+    if (count) {
+      byte(acc & 0xFF);
+    }
+    acc = count = 0;
+  }
+
+  void byte(uint8_t b) {
+    if (len < size) {
+      out[len++] = b;
+    } else {
+      overflow = true;
+    }
+  }
+
+  uint8_t *out;
+  size_t size;
+  size_t len;
+  uint32_t acc = 0;
+  uint8_t count = 0;
+  bool overflow = false;
+};
+
+// Literal/length symbol with the fixed code
+static void symbol(BitWriter &w, uint16_t sym) {
+  if (sym < 144) {
+    w.code(0x30 + sym, 8);
+  } else if (sym < 256) {
+    w.code(0x190 + sym - 144, 9);
+  } else if (sym < 280) {
+    w.code(sym - 256, 7);
+  } else {
+    w.code(0xC0 + sym - 280, 8);
+  }
+}
+
+static void match(BitWriter &w, uint16_t length, uint16_t distance) {
+  uint8_t i = 28;
+  while (lengthBase[i] > length) {
+    i--;
+  }
+  symbol(w, 257 + i);
+  w.bits(length - lengthBase[i], lengthExtra[i]);
+
+  uint8_t d = 29;
+  while (distBase[d] > distance) {
+    d--;
+  }
+  w.code(d, 5);
+  w.bits(distance - distBase[d], distExtra[d]);
+}
+
+static uint16_t hash3(const uint8_t *p) {
+  return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & ((1 << HASH_BITS) - 1);
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+  };
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+size_t gzipCompress(const uint8_t *in, size_t len, uint8_t *out, size_t size, uint16_t *head) {
+  static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+  if (len > 0xFFFF || size < sizeof(header) + 8) {
+    return 0;
+  }
+  memcpy(out, header, sizeof(header));
+
+  BitWriter w(out, size, sizeof(header));
+  w.bits(1, 1);   // Final block
+  w.bits(1, 2);   // Fixed Huffman
+
+  // Last position + 1 of each hashed prefix, 0 for none
+  memset(head, 0, GZIP_HASH_BYTES);
+  size_t pos = 0;
+  while (pos < len) {
+    uint16_t best = 0;
+    size_t from = 0;
+
+    if (pos + MIN_MATCH <= len) {
+      uint16_t h = hash3(in + pos);
+      if (head[h] && head[h] <= pos && pos - (head[h] - 1) <= MAX_DISTANCE) {
+        from = head[h] - 1;
+        size_t limit = min(len - pos, (size_t)MAX_MATCH);
+        while (best < limit && in[from + best] == in[pos + best]) {
+          best++;
+        }
+      }
+      head[h] = pos + 1;
+    }
+
+    if (best >= MIN_MATCH) {
+      match(w, best, pos - from);
+      // Hash the skipped positions so later matches can start there
+      for (size_t i = pos + 1; i < pos + best && i + MIN_MATCH <= len; i++) {
+        head[hash3(in + i)] = i + 1;
+      }
+      pos += best;
+    } else {
+      symbol(w, in[pos++]);
+    }
+  }
+  symbol(w, 256);
+  w.flush();
+
+  uint32_t crc = crc32(in, len);
+  for (uint8_t i = 0; i < 4; i++) {
+    w.byte(crc >> (8 * i));
+  }
+  for (uint8_t i = 0; i < 4; i++) {
+    w.byte(len >> (8 * i));
+  }
+
+  return w.overflow ? 0 : w.len;
+}
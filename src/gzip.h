@@ -0,0 +1,20 @@
+// Gzip header
+// Single-shot gzip (RFC 1952) with a fixed-Huffman deflate stream, small
+// and allocation free, for text bodies of a few KB
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <Arduino.h>
+
+// Hash table of the match finder, owned by the caller so that tasks can
+// compress at the same time
+#define GZIP_HASH_ENTRIES 4096
+#define GZIP_HASH_BYTES (GZIP_HASH_ENTRIES * sizeof(uint16_t))
+
+// Compress len bytes of in into out, returns the gzip size or 0 when it
+// does not fit in size bytes. Input up to 64 KB. hash is GZIP_HASH_ENTRIES
+// of scratch space.
+size_t gzipCompress(const uint8_t *in, size_t len, uint8_t *out, size_t size, uint16_t *hash);
+
+#endif // GZIP_H
@@ -0,0 +1,397 @@
+// History implementation
+// Values are stored as int16 scaled by the field's display precision.
+// Aggregated tiers are rings indexed by bucket number (uptime / period), so a
+// missed bucket is just an empty slot and no timestamps are stored for them.
+// Every tier accumulates straight from the samples, the current bucket is
+// rewritten on each one. Queries walk at most one ring, whatever the uptime.
+// The buffers are allocated by historySetup(), without them the history is
+// off and queries fail.
+
+#include "history.h"
+#include "config.h"
+#include "utils.h"
+#include "status_fields.h"
+#include "log.h"
+
+#define LOG_MODULE LOG_HISTORY
+
+static const char *const history_keys[] = {HISTORY_FIELDS};
+#define HISTORY_COUNT (sizeof(history_keys) / sizeof(history_keys[0]))
+
+#define HISTORY_EMPTY INT16_MIN
+
+enum : uint8_t { STAGE_HEADER, STAGE_POINTS, STAGE_DONE };
+
+struct HistoryPoint {
+  int16_t min;
+  int16_t avg;
+  int16_t max;
+};
+
+struct Accumulator {
+  float sum;
+  float min;
+  float max;
+  uint16_t count;
+};
+
+struct AggregateTier {
+  uint32_t period;                      // Seconds per bucket
+  uint16_t size;                        // Buckets kept
+  HistoryPoint *points;                 // [HISTORY_COUNT][size]
+  uint32_t head = 0;                    // Bucket number of the newest bucket
+  bool started = false;
+  Accumulator acc[HISTORY_COUNT] = {};  // Newest bucket so far
+};
+
+static uint32_t *raw_times = NULL;                        // [HISTORY_RAW_POINTS]
+static int16_t (*raw_values)[HISTORY_RAW_POINTS] = NULL;  // [HISTORY_COUNT][HISTORY_RAW_POINTS]
+static uint32_t raw_total = 0;          // Samples added since boot
+
+static AggregateTier tiers[HISTORY_TIERS - 1] = {
+  {HISTORY_TIER1_PERIOD, HISTORY_TIER1_POINTS, NULL},
+  {HISTORY_TIER2_PERIOD, HISTORY_TIER2_POINTS, NULL},
+};
+
+#define RAW_BYTES (HISTORY_RAW_POINTS * (sizeof(uint32_t) + HISTORY_COUNT * sizeof(int16_t)))
+#define TIER_BYTES(points) (HISTORY_COUNT * (points) * sizeof(HistoryPoint))
+
+static const StatusField *fields[HISTORY_COUNT];
+static float scales[HISTORY_COUNT];
+static SemaphoreHandle_t historyLock = NULL;
+
+static int16_t encode(float v, uint8_t f) {
+  if (isnan(v)) {
+    return HISTORY_EMPTY;
+  }
+  long x = lroundf(v * scales[f]);
+  return (int16_t)constrain(x, -INT16_MAX, (long)INT16_MAX);
+}
+
+// Point of a field in an aggregated tier
+static HistoryPoint &point(AggregateTier &tier, uint8_t f, uint32_t bucket) {
+  return tier.points[f * tier.size + bucket % tier.size];
+}
+
+void historySetup() {
+  raw_times = (uint32_t *)malloc(HISTORY_RAW_POINTS * sizeof(uint32_t));
+  raw_values = (int16_t (*)[HISTORY_RAW_POINTS])malloc(HISTORY_COUNT * sizeof(*raw_values));
+  for (uint8_t t = 0; t < HISTORY_TIERS - 1; t++) {
+    tiers[t].points = (HistoryPoint *)malloc(TIER_BYTES(tiers[t].size));
+  }
+  if (!raw_times || !raw_values || !tiers[0].points || !tiers[1].points) {
+    free(raw_times);
+    free(raw_values);
+    raw_times = NULL;
+    raw_values = NULL;
+    for (uint8_t t = 0; t < HISTORY_TIERS - 1; t++) {
+      free(tiers[t].points);
+      tiers[t].points = NULL;
+    }
+    LOGE("History: out of memory for %u bytes", (unsigned)(RAW_BYTES + TIER_BYTES(HISTORY_TIER1_POINTS) +
+                                                          TIER_BYTES(HISTORY_TIER2_POINTS)));
+    return;
+  }
+  historyLock = xSemaphoreCreateMutex();
+
+  for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+    fields[f] = findField(history_keys[f]);
+    if (!fields[f]) {
+      LOGE("Unknown history field %s", history_keys[f]);
+      continue;
+    }
+    scales[f] = powf(10, fields[f]->precision);
+  }
+
+  for (uint8_t t = 0; t < HISTORY_TIERS - 1; t++) {
+    for (size_t i = 0; i < (size_t)HISTORY_COUNT * tiers[t].size; i++) {
+      tiers[t].points[i] = {HISTORY_EMPTY, HISTORY_EMPTY, HISTORY_EMPTY};
+    }
+  }
+
+  LOGI("History: %u fields, %u bytes", (unsigned)HISTORY_COUNT, (unsigned)historyMemory());
+}
+
+void historyAdd(const Snapshot &snap) {
+  // Values of a sample without valid data are meaningless
+  if (!snap.inverter.valid_info || !historyLock) {
+    return;
+  }
+
+  float values[HISTORY_COUNT];
+  for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+    values[f] = fields[f] ? fieldValue(snap, *fields[f]) : NAN;
+  }
+
+  uint32_t t = snap.uptime;
+
+  xSemaphoreTake(historyLock, portMAX_DELAY);
+
+  uint16_t slot = raw_total % HISTORY_RAW_POINTS;
+  raw_times[slot] = t;
+  for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+    raw_values[f][slot] = encode(values[f], f);
+  }
+  raw_total++;
+
+  for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+    AggregateTier &tier = tiers[i];
+    uint32_t bucket = t / tier.period;
+
+    if (!tier.started || bucket > tier.head) {
+      // Buckets without samples in between stay empty
+      if (tier.started) {
+        uint32_t gap = min(bucket - tier.head - 1, (uint32_t)tier.size);
+        for (uint32_t b = tier.head + 1; b <= tier.head + gap; b++) {
+          for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+            point(tier, f, b) = {HISTORY_EMPTY, HISTORY_EMPTY, HISTORY_EMPTY};
+          }
+        }
+      }
+      tier.head = bucket;
+      tier.started = true;
+      memset(tier.acc, 0, sizeof(tier.acc));
+    }
+
+    for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+      Accumulator &acc = tier.acc[f];
+      float v = values[f];
+      if (isnan(v)) {
+        continue;
+      }
+      acc.sum += v;
+      acc.min = acc.count ? min(acc.min, v) : v;
+      acc.max = acc.count ? max(acc.max, v) : v;
+      acc.count++;
+      point(tier, f, bucket) = {encode(acc.min, f), encode(acc.sum / acc.count, f), encode(acc.max, f)};
+    }
+  }
+
+  xSemaphoreGive(historyLock);
+}
+
+bool historyQuery(HistoryQuery &q, const char *key, long from, long res) {
+  q = {};
+  q.now = uptime();
+
+  const StatusField *field = findField(key);
+  bool found = false;
+  for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+    if (field && fields[f] == field) {
+      q.field = f;
+      found = true;
+    }
+  }
+  if (!found || !historyLock) {
+    return false;
+  }
+
+  if (from < 0) {
+    from = max((long)q.now + from, 0L);
+  }
+  q.from = from;
+
+  xSemaphoreTake(historyLock, portMAX_DELAY);
+
+  uint32_t rawOldest = raw_total ? raw_times[raw_total > HISTORY_RAW_POINTS ? raw_total % HISTORY_RAW_POINTS : 0] : 0;
+
+  if (res < 0) {
+    // Finest tier that still holds from
+    q.tier = HISTORY_TIERS - 1;
+    if (raw_total <= HISTORY_RAW_POINTS || rawOldest <= q.from) {
+      q.tier = 0;
+    } else {
+      for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+        if (q.now - min(q.from, q.now) < tiers[i].period * tiers[i].size) {
+          q.tier = i + 1;
+          break;
+        }
+      }
+    }
+  } else if (res == 0) {
+    q.tier = 0;
+  } else {
+    bool known = false;
+    for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+      if ((unsigned long)res == tiers[i].period) {
+        q.tier = i + 1;
+        known = true;
+      }
+    }
+    if (!known) {
+      xSemaphoreGive(historyLock);
+      return false;
+    }
+  }
+
+  if (q.tier == 0) {
+    q.cursor = raw_total > HISTORY_RAW_POINTS ? raw_total - HISTORY_RAW_POINTS : 0;
+    q.end = raw_total;
+  } else {
+    AggregateTier &tier = tiers[q.tier - 1];
+    uint32_t oldest = tier.head + 1 > tier.size ? tier.head + 1 - tier.size : 0;
+    q.cursor = max(q.from / tier.period, oldest);
+    q.end = tier.started ? tier.head + 1 : 0;
+  }
+
+  xSemaphoreGive(historyLock);
+  return true;
+}
+
+// Render one point, returns its length or 0 for an empty slot
+static size_t renderPoint(const HistoryQuery &q, JsonWriter &w) {
+  const StatusField &field = *fields[q.field];
+  float scale = scales[q.field];
+
+  if (q.tier == 0) {
+    uint16_t slot = q.cursor % HISTORY_RAW_POINTS;
+    int16_t v = raw_values[q.field][slot];
+    if (v == HISTORY_EMPTY || raw_times[slot] < q.from) {
+      return 0;
+    }
+    w.raw(q.first ? "[" : ",[");
+    w.u32(raw_times[slot]);
+    w.raw(',');
+    w.fixed(v / scale, field.precision);
+  } else {
+    AggregateTier &tier = tiers[q.tier - 1];
+    const HistoryPoint &p = point(tier, q.field, q.cursor);
+    if (p.avg == HISTORY_EMPTY) {
+      return 0;
+    }
+    w.raw(q.first ? "[" : ",[");
+    w.u32(q.cursor * tier.period);
+    w.raw(',');
+    w.fixed(p.min / scale, field.precision);
+    w.raw(',');
+    w.fixed(p.avg / scale, field.precision);
+    w.raw(',');
+    w.fixed(p.max / scale, field.precision);
+  }
+  w.raw(']');
+  return w.length();
+}
+
+// Render the next piece of the response into q.item: the header, one
+// point or the footer
+static void nextItem(HistoryQuery &q) {
+  JsonWriter w(q.item, sizeof(q.item));
+
+  switch (q.stage) {
+    case STAGE_HEADER:
+      w.raw('{');
+      w.key("field");
+      w.str(history_keys[q.field]);
+      w.raw(',');
+      w.key("unit");
+      w.str(fields[q.field]->unit);
+      w.raw(',');
+      w.key("res");
+      w.u32(q.tier ? tiers[q.tier - 1].period : 0);
+      w.raw(',');
+      w.key("now");
+      w.u32(q.now);
+      w.raw(',');
+      w.key("points");
+      w.raw('[');
+      q.first = true;
+      q.stage = STAGE_POINTS;
+      break;
+
+    case STAGE_POINTS: {
+      xSemaphoreTake(historyLock, portMAX_DELAY);
+
+      // Skip what got overwritten while the response was being sent
+      uint32_t oldest;
+      if (q.tier == 0) {
+        oldest = raw_total > HISTORY_RAW_POINTS ? raw_total - HISTORY_RAW_POINTS : 0;
+      } else {
+        AggregateTier &tier = tiers[q.tier - 1];
+        oldest = tier.head + 1 > tier.size ? tier.head + 1 - tier.size : 0;
+      }
+      q.cursor = max(q.cursor, oldest);
+
+      while (q.cursor < q.end && !renderPoint(q, w)) {
+        q.cursor++;
+      }
+
+      xSemaphoreGive(historyLock);
+
+      if (q.cursor < q.end) {
+        q.cursor++;
+        q.first = false;
+      } else {
+        w.raw("]}");
+        q.stage = STAGE_DONE;
+      }
+      break;
+    }
+  }
+
+  q.itemLen = w.length();
+  q.itemSent = 0;
+}
+
+size_t historyRead(HistoryQuery &q, char *buf, size_t size) {
+  size_t len = 0;
+
+  // Pieces are rendered once and may span chunks, the window can be small
+  for (;;) {
+    size_t n = min((size_t)(q.itemLen - q.itemSent), size - len);
+    memcpy(buf + len, q.item + q.itemSent, n);
+    len += n;
+    q.itemSent += n;
+
+    if (q.itemSent < q.itemLen || q.stage == STAGE_DONE) {
+      return len;
+    }
+    nextItem(q);
+  }
+}
+
+void historyInfoJson(JsonWriter &w) {
+  w.raw('{');
+  w.key("memory");
+  w.u32(historyMemory());
+  w.raw(',');
+  w.key("fields");
+  w.raw('[');
+  for (uint8_t f = 0; f < HISTORY_COUNT; f++) {
+    if (f) {
+      w.raw(',');
+    }
+    w.str(history_keys[f]);
+  }
+  w.raw("],");
+  w.key("tiers");
+  w.raw("[{");
+  w.key("res");
+  w.u32(0);
+  w.raw(',');
+  w.key("points");
+  w.u32(HISTORY_RAW_POINTS);
+  w.raw(',');
+  w.key("used");
+  w.u32(min(raw_total, (uint32_t)HISTORY_RAW_POINTS));
+  w.raw('}');
+  for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+    w.raw(",{");
+    w.key("res");
+    w.u32(tiers[i].period);
+    w.raw(',');
+    w.key("points");
+    w.u32(tiers[i].size);
+    w.raw(',');
+    w.key("span");
+    w.u32(tiers[i].period * tiers[i].size);
+    w.raw('}');
+  }
+  w.raw("]}");
+}
+
+size_t historyMemory() {
+  if (!historyLock) {
+    return sizeof(tiers);
+  }
+  return RAW_BYTES + TIER_BYTES(HISTORY_TIER1_POINTS) + TIER_BYTES(HISTORY_TIER2_POINTS) + sizeof(tiers);
+}
@@ -0,0 +1,52 @@
+// History header
+// Fixed-memory, multi-resolution history of the HISTORY_FIELDS: every
+// sample for the last half hour, then min/avg/max per minute and per
+// quarter of an hour, rolled up as samples arrive
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+#include "json_utils.h"
+
+#define HISTORY_TIERS 3   // Raw samples and two aggregated tiers
+
+// State of one /api/history response, advanced chunk by chunk
+struct HistoryQuery {
+  uint8_t field;      // Index in HISTORY_FIELDS
+  uint8_t tier;       // 0 raw, then the aggregated tiers
+  uint8_t stage;      // Header, points, done
+  bool first;         // No point written yet
+  uint32_t from;      // uptime() seconds
+  uint32_t now;
+  uint32_t cursor;    // Next raw sample or bucket number
+  uint32_t end;       // Past the newest one when the query started
+  char item[128];     // Rendered piece not fully sent yet
+  uint8_t itemLen;
+  uint8_t itemSent;
+};
+
+// Allocate the buffers, resolve the configured fields and clear them. The
+// history stays off when the heap is short.
+void historySetup();
+
+// Add a published sample, acquisition task only
+void historyAdd(const Snapshot &snap);
+
+// Start a query on a "section.key" field. from is uptime() seconds, or
+// seconds before now when negative. res is the resolution in seconds, 0 for
+// raw samples or negative to pick the finest tier covering from.
+// False for an unknown field or resolution.
+bool historyQuery(HistoryQuery &q, const char *field, long from, long res);
+
+// Write the next part of the query response, 0 when it is complete
+size_t historyRead(HistoryQuery &q, char *buf, size_t size);
+
+// Fields, tiers and memory use
+void historyInfoJson(JsonWriter &w);
+
+// Bytes of RAM held by the history buffers
+size_t historyMemory();
+
+#endif // HISTORY_H
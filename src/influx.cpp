@@ -0,0 +1,415 @@
+// InfluxDB writer implementation
+// Each new sample is packed into a compact record, one varint per status
+// field, and appended to a byte ring spool; it becomes line protocol, one
+// line per status section with its keys as float fields (the schema the
+// Python bridge wrote), only when its batch is built. The timestamp is
+// derived from the sample's uptime then too: the device only has a wall
+// clock once SNTP answered.
+// A batch goes out when INFLUX_BATCH_SAMPLES are spooled or the oldest one
+// is INFLUX_BATCH_SECONDS old; on failure it stays spooled and is retried,
+// and when the server is away long enough the oldest samples are dropped.
+
+#include "influx.h"
+#include "config.h"
+#include "utils.h"
+#include "snapshot.h"
+#include "status_fields.h"
+#include "json_utils.h"
+#include "gzip.h"
+#include "credentials.h"
+#include <WiFiClient.h>
+#include <time.h>
+#include "log.h"
+
+#define LOG_MODULE LOG_INFLUX
+
+#define ENTRY_HEADER 6              // uptime (4) + text length (2)
+#define TIMESTAMP_MAX 12            // " 1234567890" per line
+#define VARINT_MAX 5                // Largest field code, below 2^35
+#define VALID_EPOCH 1600000000UL    // Anything earlier means SNTP has not answered yet
+
+static const char *serverHost = NULL;
+static uint16_t serverPort = 0;
+
+// Spool: [uptime, 4 bytes][length, 2 bytes][record] entries, oldest at head.
+// Allocated by influxBegin() so a disabled writer costs no RAM.
+static uint8_t *spool = NULL;
+static size_t spoolHead = 0;
+static size_t spoolUsed = 0;
+static size_t spoolCount = 0;
+
+static char *body = NULL;           // Batch being sent, plain line protocol
+static uint8_t *packed = NULL;      // Same batch gzipped
+static uint16_t *gzipHash = NULL;   // Match finder of gzipCompress()
+static uint8_t *record = NULL;      // One sample, packed
+static char *lines = NULL;          // One sample as line protocol
+
+static uint32_t lastSeq = 0;
+static unsigned long lastFailure = 0;
+static bool flushRequested = false;
+
+static InfluxStats stats;
+
+// ==================== SPOOL ====================
+
+static void spoolCopyOut(size_t offset, uint8_t *dst, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = spool[(spoolHead + offset + i) % INFLUX_SPOOL_BYTES];
+  }
+}
+
+// Uptime and text length of the entry at offset
+static void entryHeader(size_t offset, uint32_t &uptime, uint16_t &len) {
+  uint8_t h[ENTRY_HEADER];
+  spoolCopyOut(offset, h, sizeof(h));
+  uptime = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | (h[2] << 8) | h[3];
+  len = (h[4] << 8) | h[5];
+}
+
+static void popHead() {
+  uint32_t t;
+  uint16_t len;
+  entryHeader(0, t, len);
+  spoolHead = (spoolHead + ENTRY_HEADER + len) % INFLUX_SPOOL_BYTES;
+  spoolUsed -= ENTRY_HEADER + len;
+  spoolCount--;
+}
+
+static void push(uint32_t uptime, const uint8_t *data, uint16_t len) {
+  size_t entry = ENTRY_HEADER + len;
+  if (entry > INFLUX_SPOOL_BYTES) {
+    stats.dropped++;
+    return;
+  }
+  while (INFLUX_SPOOL_BYTES - spoolUsed < entry) {
+    popHead();
+    stats.dropped++;
+  }
+
+  uint8_t h[ENTRY_HEADER] = {(uint8_t)(uptime >> 24), (uint8_t)(uptime >> 16), (uint8_t)(uptime >> 8),
+                             (uint8_t)uptime, (uint8_t)(len >> 8), (uint8_t)len};
+  size_t tail = spoolHead + spoolUsed;
+  for (uint8_t i = 0; i < ENTRY_HEADER; i++) {
+    spool[tail++ % INFLUX_SPOOL_BYTES] = h[i];
+  }
+  for (uint16_t i = 0; i < len; i++) {
+    spool[tail++ % INFLUX_SPOOL_BYTES] = data[i];
+  }
+  spoolUsed += entry;
+  spoolCount++;
+}
+
+// ==================== RECORDS ====================
+
+// A field is coded as 0 when line protocol has to leave it out, else as 1 +
+// the zigzag of its value in units of its last displayed digit, the number
+// JsonWriter::fixed() would print. About 3 bytes a field, a tenth of its
+// line protocol.
+static const uint32_t scales[] = {1, 10, 100, 1000, 10000};
+
+static uint64_t fieldCode(const Snapshot &snap, const StatusField &f) {
+  const uint8_t *p = (const uint8_t *)&snap + f.offset;
+  switch (f.type) {
+    case FIELD_U8:
+      return 2 * (uint64_t)*p + 1;
+    case FIELD_U16: {
+      uint16_t u;
+      memcpy(&u, p, sizeof(u));
+      return 2 * (uint64_t)u + 1;
+    }
+    case FIELD_U32: {
+      uint32_t u;
+      memcpy(&u, p, sizeof(u));
+      return 2 * (uint64_t)u + 1;
+    }
+    default:
+      break;
+  }
+
+  float v;
+  memcpy(&v, p, sizeof(v));
+  uint8_t precision = min(f.precision, (uint8_t)4);
+  if (!isfinite(v) || fabsf(v) >= 4.0e9f / scales[precision]) {
+    return 0;
+  }
+  uint64_t scaled = (uint32_t)(fabsf(v) * scales[precision] + 0.5f);
+  return v < 0 && scaled ? 2 * scaled : 2 * scaled + 1;
+}
+
+static void spoolSample(const Snapshot &snap) {
+  uint16_t len = 0;
+  for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+    uint64_t code = fieldCode(snap, status_fields[i]);
+    do {
+      record[len++] = (code & 0x7F) | (code > 0x7F ? 0x80 : 0);
+      code >>= 7;
+    } while (code);
+  }
+  push(snap.uptime, record, len);
+}
+
+static uint64_t readCode(const uint8_t *&p, const uint8_t *end) {
+  uint64_t code = 0;
+  for (uint8_t shift = 0; p < end; shift += 7) {
+    uint8_t b = *p++;
+    code |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      break;
+    }
+  }
+  return code;
+}
+
+// ==================== LINE PROTOCOL ====================
+
+// "<section> key=value,key=value <ts>\n" for each section with a value,
+// into lines. Returns the length, 0 when it does not fit.
+static size_t renderSample(const uint8_t *data, uint16_t len, const char *ts) {
+  JsonWriter w(lines, INFLUX_SAMPLE_MAX);
+  const uint8_t *p = data;
+  const uint8_t *end = data + len;
+
+  uint8_t section = 0xFF;
+  for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+    const StatusField &f = status_fields[i];
+    uint64_t code = readCode(p, end);
+    if (!code) {
+      continue;
+    }
+    if (f.section != section) {
+      if (section != 0xFF) {
+        w.raw(ts);
+        w.raw('\n');
+      }
+      section = f.section;
+      w.raw(status_sections[section].key);
+      w.raw(' ');
+    } else {
+      w.raw(',');
+    }
+    w.raw(f.key);
+    w.raw('=');
+    code--;
+    if (f.type == FIELD_FLOAT) {
+      w.decimal(code & 1, (code + 1) / 2, f.precision);
+    } else {
+      w.u32(code / 2);
+    }
+  }
+  if (section != 0xFF) {
+    w.raw(ts);
+    w.raw('\n');
+  }
+  return w.full() ? 0 : w.length();
+}
+
+// Render up to INFLUX_BATCH_SAMPLES entries into body, with timestamps.
+// Returns the body length, entries tells how many it holds.
+static size_t buildBatch(size_t &entries) {
+  uint32_t now = uptime();
+  uint32_t epoch = time(NULL);
+  size_t len = 0;
+  size_t offset = 0;
+  entries = 0;
+
+  while (entries < spoolCount && entries < INFLUX_BATCH_SAMPLES) {
+    uint32_t t;
+    uint16_t dataLen;
+    entryHeader(offset, t, dataLen);
+    spoolCopyOut(offset + ENTRY_HEADER, record, dataLen);
+
+    char ts[TIMESTAMP_MAX];
+    snprintf(ts, sizeof(ts), " %lu", (unsigned long)(epoch - (now - t)));
+
+    size_t textLen = renderSample(record, dataLen, ts);
+    if (!textLen || len + textLen > INFLUX_BODY_MAX) {
+      break;
+    }
+    memcpy(body + len, lines, textLen);
+    len += textLen;
+    offset += ENTRY_HEADER + dataLen;
+    entries++;
+  }
+  return len;
+}
+
+// ==================== HTTP ====================
+
+// POST the body, returns the HTTP status or -1 when there was no answer
+static int post(const uint8_t *data, size_t len, bool gzipped) {
+  WiFiClient client;
+  if (!client.connect(serverHost, serverPort, INFLUX_TIMEOUT_MS)) {
+    return -1;
+  }
+
+  char head[256 + sizeof(INFLUX_PATH)];
+  size_t headLen = snprintf(head, sizeof(head),
+                            "POST " INFLUX_PATH " HTTP/1.1\r\n"
+                            "Host: %s:%u\r\n"
+                            "Authorization: Token %s\r\n"
+                            "Content-Type: text/plain; charset=utf-8\r\n"
+                            "%s"
+                            "Content-Length: %u\r\n"
+                            "Connection: close\r\n\r\n",
+                            serverHost, serverPort, influxToken(),
+                            gzipped ? "Content-Encoding: gzip\r\n" : "", (unsigned)len);
+  if (headLen >= sizeof(head) || client.write((const uint8_t *)head, headLen) != headLen) {
+    return -1;
+  }
+
+  size_t sent = 0;
+  while (sent < len) {
+    size_t n = client.write(data + sent, len - sent);
+    if (n == 0) {
+      return -1;
+    }
+    sent += n;
+  }
+
+  // Status line only, "HTTP/1.1 204 No Content"
+  char status[16];
+  size_t got = 0;
+  unsigned long start = millis();
+  while (got < sizeof(status) - 1 && millis() - start < INFLUX_TIMEOUT_MS) {
+    int c = client.available() ? client.read() : -1;
+    if (c < 0) {
+      if (!client.connected()) {
+        break;
+      }
+      delay(5);
+      continue;
+    }
+    if (c == '\n') {
+      break;
+    }
+    status[got++] = c;
+  }
+  status[got] = 0;
+  client.stop();
+
+  const char *code = strchr(status, ' ');
+  return code ? atoi(code + 1) : -1;
+}
+
+static void sendBatch() {
+  size_t entries;
+  size_t len = buildBatch(entries);
+  if (!entries) {
+    // A sample longer than INFLUX_SAMPLE_MAX or a whole body can never be sent
+    popHead();
+    stats.dropped++;
+    return;
+  }
+
+  const uint8_t *data = (const uint8_t *)body;
+  size_t dataLen = len;
+  bool gzipped = false;
+  if (INFLUX_GZIP) {
+    size_t n = gzipCompress((const uint8_t *)body, len, packed, INFLUX_BODY_MAX, gzipHash);
+    if (n && n < len) {
+      data = packed;
+      dataLen = n;
+      gzipped = true;
+    }
+  }
+
+  int code = post(data, dataLen, gzipped);
+  if (code >= 200 && code < 300) {
+    stats.posts++;
+    stats.written += entries;
+    stats.rawBytes += len;
+    stats.sentBytes += dataLen;
+    lastFailure = 0;
+  } else if (code == 400 || code == 413) {
+    // Retrying a batch the server refuses to parse would block the spool
+    LOGE("InfluxDB rejected a batch, HTTP %d", code);
+    stats.failures++;
+    stats.dropped += entries;
+  } else {
+    LOGW("InfluxDB write failed, HTTP %d", code);
+    stats.failures++;
+    lastFailure = millis();
+    return;
+  }
+
+  for (size_t i = 0; i < entries; i++) {
+    popHead();
+  }
+}
+
+// ==================== TASK ====================
+
+void influxBegin(const char *host, uint16_t port) {
+  if (!spool) {
+    spool = (uint8_t *)malloc(INFLUX_SPOOL_BYTES);
+    body = (char *)malloc(INFLUX_BODY_MAX);
+    packed = (uint8_t *)malloc(INFLUX_BODY_MAX);
+    lines = (char *)malloc(INFLUX_SAMPLE_MAX);
+    record = (uint8_t *)malloc(STATUS_FIELDS * VARINT_MAX);
+    gzipHash = (uint16_t *)malloc(GZIP_HASH_BYTES);
+    if (!spool || !body || !packed || !lines || !record || !gzipHash) {
+      LOGE("InfluxDB writer: out of memory");
+      return;
+    }
+  }
+  serverHost = host;
+  serverPort = port;
+}
+
+void influxLoop() {
+  if (!serverHost) {
+    return;
+  }
+
+  // Samples are spooled even while the server is away, the spool bounds the backlog
+  uint32_t seq = snapshotSeq();
+  if (seq != lastSeq) {
+    lastSeq = seq;
+    Snapshot snap;
+    readSnapshot(snap);
+    if (snap.inverter.valid_info) {
+      spoolSample(snap);
+    }
+  }
+
+  if (!spoolCount || (uint32_t)time(NULL) < VALID_EPOCH) {
+    return;
+  }
+  if (lastFailure && millis() - lastFailure < INFLUX_RETRY_INTERVAL * 1000UL) {
+    return;
+  }
+
+  uint32_t oldest;
+  uint16_t len;
+  entryHeader(0, oldest, len);
+  if (flushRequested || spoolCount >= INFLUX_BATCH_SAMPLES || uptime() - oldest >= INFLUX_BATCH_SECONDS) {
+    sendBatch();
+    flushRequested = spoolCount > 0 && !lastFailure;
+  }
+}
+
+void influxFlush() {
+  flushRequested = true;
+}
+
+InfluxStats influxStats() {
+  InfluxStats s = stats;
+  s.spooled = spoolCount;
+  return s;
+}
+
+#ifndef NATIVE
+static void influxTask(void *param) {
+  for (;;) {
+    influxLoop();
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+}
+
+void influxSetup() {
+  configTime(0, 0, NTP_SERVER);
+  influxBegin(INFLUX_HOST, INFLUX_PORT);
+  xTaskCreatePinnedToCore(influxTask, "influx", INFLUX_TASK_STACK, NULL, INFLUX_TASK_PRIORITY, NULL, INFLUX_TASK_CORE);
+  LOGI("InfluxDB writer started");
+}
+#endif
@@ -0,0 +1,34 @@
+// InfluxDB writer header
+// Formats samples as line protocol and POSTs them in batches to an
+// InfluxDB 2 /api/v2/write endpoint, replacing the Python bridge
+
+#ifndef INFLUX_H
+#define INFLUX_H
+
+#include <Arduino.h>
+
+struct InfluxStats {
+  uint32_t written;     // Samples accepted by the server
+  uint32_t dropped;     // Samples dropped from a full spool or rejected as malformed
+  uint32_t posts;       // Successful POSTs
+  uint32_t failures;    // POSTs that did not get a 2xx
+  uint32_t rawBytes;    // Line protocol sent, before compression
+  uint32_t sentBytes;   // Bodies sent, after compression
+  size_t spooled;       // Samples waiting in the spool
+};
+
+// Start SNTP and the writer task
+void influxSetup();
+
+// Server to write to and its spool, without starting the task (host build)
+void influxBegin(const char *host, uint16_t port);
+
+// One round: spool a new sample, POST a batch when due, writer task only
+void influxLoop();
+
+// POST everything spooled regardless of the batch size
+void influxFlush();
+
+InfluxStats influxStats();
+
+#endif // INFLUX_H
@@ -4,76 +4,614 @@
 #include "json_utils.h"
 #include "globals.h"
 #include "utils.h"
+#include "modbus.h"
+#include "snapshot.h"
+#include "status_fields.h"
+#include "cbor_utils.h"
+#include "log.h"
+#include "perf.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
-
-// Generate JSON string from inverter data
-String dataJson() {
-    JsonDocument doc;
-
-    JsonObject acObj = doc["ac"].to<JsonObject>();
-    acObj["input_voltage"] = ac.input_voltage;
-    acObj["input_freq"] = ac.input_freq;
-    acObj["output_voltage"] = ac.output_voltage;
-    acObj["output_freq"] = ac.output_freq;
-    acObj["output_load_percent"] = ac.output_load_percent;
-    acObj["power_factor"] = ac.power_factor;
-    acObj["output_va"] = ac.output_va;
-    acObj["output_watts"] = ac.output_watts;
-
-    JsonObject dcObj = doc["dc"].to<JsonObject>();
-    dcObj["voltage"] = dc.voltage;
-    dcObj["voltage_corrected"] = dc.voltage_corrected;
-    dcObj["charge_power"] = dc.charge_power;
-    dcObj["discharge_power"] = dc.discharge_power;
-    dcObj["charge_current"] = dc.charge_current;
-    dcObj["discharge_current"] = dc.discharge_current;
-    dcObj["new_k"] = dc.new_k;
-    dcObj["batt_v_compensation_k"] = dc.batt_v_compensation_k;
-
-    JsonObject pvObj = doc["pv"].to<JsonObject>();
-    pvObj["pv_voltage"] = dc.pv_voltage;
-    pvObj["pv_power"] = dc.pv_power;
-    pvObj["pv_current"] = dc.pv_current;
-    pvObj["pv_energy_produced"] = dc.pv_energy_produced;
-
-    JsonObject iObj = doc["inverter"].to<JsonObject>();
-    iObj["valid_info"] = inverter.valid_info;
-    iObj["op_mode"] = inverter.op_mode;
-    iObj["soc"] = inverter.soc;
-    iObj["gas_gauge"] = inverter.gas_gauge;
-    iObj["battery_energy"] = inverter.battery_energy;
-    iObj["temp"] = inverter.temp;
-    iObj["read_interval"] = dynamic_read_interval;
-    iObj["read_time"] = inverter.read_time;
-    iObj["read_time_mean"] = inverter.read_time_mean;
-    iObj["charger"] = inverter.charger;
-    iObj["eff_w"] = inverter.eff_w;
-    iObj["energy_spent_ac"] = inverter.energy_spent_ac;
-    iObj["energy_source_ac"] = inverter.energy_source_ac;
-    iObj["energy_source_batt"] = inverter.energy_source_batt;
-    iObj["energy_source_pv"] = inverter.energy_source_pv;
-    iObj["autonomy"] = inverter.autonomy;
-    iObj["json_size"] = measureJson(doc);
-    iObj["uptime"] = uptime();
-
-    if (doc.overflowed()) {
-        sprintln("ERROR - Json overflowed");
-        sprint("Doc Usage: ");
-        sprintln((int)measureJson(doc));
-    }
-
-    String output;
-    serializeJson(doc, output);
-    doc.clear();
-
-    return output;
+#define LOG_MODULE LOG_WEB
+
+// Serialized status of the last two samples; the older one stays intact
+// for responses still being sent when a new sample comes in
+struct StatusCache {
+    uint32_t seq;
+    size_t len;
+    char etag[24];
+    char body[STATUS_JSON_MAX];
+};
+
+static StatusCache caches[STATUS_FORMATS][2];
+static uint8_t newest[STATUS_FORMATS];
+
+void JsonWriter::raw(char c) {
+    if (pos++ < skip) {
+        return;
+    }
+    if (len < size) {
+        buf[len++] = c;
+    } else {
+        overflow = true;
+    }
+}
+
+void JsonWriter::raw(const char *s) {
+    while (*s) {
+        raw(*s++);
+    }
+}
+
+void JsonWriter::str(const char *s) {
+    static const char hex[] = "0123456789abcdef";
+
+    raw('"');
+    for (; *s; s++) {
+        uint8_t c = *s;
+        if (c == '"' || c == '\\') {
+            raw('\\');
+            raw((char)c);
+        } else if (c < 0x20) {
+            raw("\\u00");
+            raw(hex[c >> 4]);
+            raw(hex[c & 0xF]);
+        } else {
+            raw((char)c);
+        }
+    }
+    raw('"');
+}
+
+void JsonWriter::key(const char *k) {
+    str(k);
+    raw(':');
+}
+
+void JsonWriter::u32(uint32_t v) {
+    char digits[10];
+    uint8_t n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) {
+        raw(digits[--n]);
+    }
+}
+
+// Fixed point without printf, NaN and infinities are not valid JSON
+void JsonWriter::fixed(float v, uint8_t precision) {
+    static const uint32_t scales[] = {1, 10, 100, 1000, 10000};
+
+    precision = min(precision, (uint8_t)4);
+    if (isnan(v) || isinf(v) || fabsf(v) >= 4.0e9f / scales[precision]) {
+        raw("null");
+        return;
+    }
+
+    decimal(v < 0, (uint32_t)(fabsf(v) * scales[precision] + 0.5f), precision);
+}
+
+void JsonWriter::decimal(bool negative, uint32_t scaled, uint8_t precision) {
+    static const uint32_t scales[] = {1, 10, 100, 1000, 10000};
+
+    precision = min(precision, (uint8_t)4);
+    // No "-0.0" for values that round to zero
+    if (negative && scaled) {
+        raw('-');
+    }
+    u32(scaled / scales[precision]);
+    if (precision) {
+        raw('.');
+        uint32_t frac = scaled % scales[precision];
+        for (uint32_t s = scales[precision] / 10; s; s /= 10) {
+            raw((char)('0' + frac / s % 10));
+        }
+    }
+}
+
+void JsonWriter::value(const Snapshot &snap, const StatusField &f) {
+    const uint8_t *p = (const uint8_t *)&snap + f.offset;
+
+    switch (f.type) {
+        case FIELD_FLOAT: {
+            float v;
+            memcpy(&v, p, sizeof(v));
+            fixed(v, f.precision);
+            break;
+        }
+        case FIELD_U8:
+            u32(*p);
+            break;
+        case FIELD_U16: {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            u32(v);
+            break;
+        }
+        case FIELD_U32: {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            u32(v);
+            break;
+        }
+    }
+}
+
+void JsonWriter::field(const Snapshot &snap, const StatusField &f) {
+    key(f.key);
+    value(snap, f);
+}
+
+// Bytes written so far, as the ArduinoJson document used to report it
+static void jsonSize(JsonWriter &w) {
+    w.raw(',');
+    w.key("json_size");
+    w.u32(w.length());
+}
+
+// Serialize a sample into buf, returns the length or 0 if it did not fit
+size_t statusJson(const Snapshot &snap, char *buf, size_t size) {
+    PERF_SCOPE(PERF_STATUS_JSON);
+
+    // Room for the terminator, SSE sends C strings
+    JsonWriter w(buf, size - 1);
+
+    w.raw('{');
+    w.key("seq");
+    w.u32(snap.seq);
+
+    int8_t section = -1;
+    for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+        const StatusField &f = status_fields[i];
+        if (f.section != section) {
+            if (section == STATUS_SECTION_INVERTER) {
+                jsonSize(w);
+            }
+            w.raw(section < 0 ? "," : "},");
+            section = f.section;
+            w.key(status_sections[section].key);
+            w.raw('{');
+        } else {
+            w.raw(',');
+        }
+        w.field(snap, f);
+    }
+    if (section == STATUS_SECTION_INVERTER) {
+        jsonSize(w);
+    }
+    w.raw("}}");
+
+    if (w.full()) {
+        LOGE("Status payload too big for buffer");
+        return 0;
+    }
+
+    buf[w.length()] = 0;
+    return w.length();
+}
+
+// Status payload of the latest sample, serialized once per sample and format.
+// Called from the AsyncTCP task only.
+const char *statusPayload(StatusFormat format, size_t &len, const char *&etag) {
+    uint32_t seq = snapshotSeq();
+    StatusCache *cache = &caches[format][newest[format]];
+
+    if (cache->seq != seq || cache->len == 0) {
+        static uint32_t bootId = esp_random();
+
+        Snapshot snap;
+        readSnapshot(snap);
+
+        cache = &caches[format][newest[format] ^ 1];
+        cache->seq = snap.seq;
+        if (format == STATUS_CBOR) {
+            cache->len = statusCbor(snap, (uint8_t *)cache->body, sizeof(cache->body));
+        } else {
+            cache->len = statusJson(snap, cache->body, sizeof(cache->body));
+        }
+        // Boot id in the tag, seq starts over after a reboot
+        snprintf(cache->etag, sizeof(cache->etag), "\"%08x-%u%s\"", (unsigned)bootId, (unsigned)snap.seq,
+                 format == STATUS_CBOR ? "c" : "");
+        newest[format] ^= 1;
+    }
+
+    len = cache->len;
+    etag = cache->etag;
+    return cache->body;
+}
+
+// Same layout as /api/status, with name, unit and description in place of
+// each value
+void namesJson(JsonWriter &w) {
+    w.raw('{');
+    for (uint8_t s = 0; s < STATUS_SECTIONS; s++) {
+        const StatusSection &section = status_sections[s];
+        if (s) {
+            w.raw(',');
+        }
+        w.key(section.key);
+        w.raw('{');
+        w.key("name");
+        w.str(section.name);
+        w.raw(',');
+        w.key("description");
+        w.str(section.description);
+
+        for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+            const StatusField &f = status_fields[i];
+            if (f.section != s) {
+                continue;
+            }
+            w.raw(',');
+            w.key(f.key);
+            w.raw('{');
+            w.key("name");
+            w.str(f.name);
+            w.raw(',');
+            w.key("unit");
+            w.str(f.unit);
+            w.raw(',');
+            w.key("description");
+            w.str(f.description);
+            if (f.address) {
+                w.raw(',');
+                w.key("register");
+                w.u32(f.address);
+            }
+            w.raw('}');
+        }
+        w.raw('}');
+    }
+    w.raw('}');
+}
+
+// Field id manifest for /api/status.cbor
+void fieldsJson(JsonWriter &w) {
+    w.raw('{');
+    w.key("seq");
+    w.u32(STATUS_FIELD_SEQ);
+    w.raw(',');
+    w.key("fields");
+    w.raw('[');
+    for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+        const StatusField &f = status_fields[i];
+        if (i) {
+            w.raw(',');
+        }
+        w.raw('{');
+        w.key("id");
+        w.u32(f.id);
+        w.raw(',');
+        w.key("section");
+        w.str(status_sections[f.section].key);
+        w.raw(',');
+        w.key("key");
+        w.str(f.key);
+        w.raw(',');
+        w.key("type");
+        w.str(f.type == FIELD_FLOAT ? "float" : "uint");
+        w.raw(',');
+        w.key("precision");
+        w.u32(f.precision);
+        w.raw(',');
+        w.key("unit");
+        w.str(f.unit);
+        if (f.address) {
+            w.raw(',');
+            w.key("register");
+            w.u32(f.address);
+            w.raw(',');
+            w.key("scale");
+            w.u32(f.scale);
+            w.raw(',');
+            w.key("signed");
+            w.raw(f.is_signed ? "true" : "false");
+        }
+        w.raw('}');
+    }
+    w.raw("]}");
+}
+
+static void countersJson(JsonWriter &w, const ModbusCounters &c) {
+    const struct {
+        const char *key;
+        uint32_t value;
+    } counters[] = {
+        {"requests", c.requests},
+        {"failures", c.failures},
+        {"attempts", c.attempts},
+        {"replies", c.replies},
+        {"timeouts", c.timeouts},
+        {"crc_errors", c.crc_errors},
+        {"exceptions", c.exceptions},
+        {"invalid", c.invalid},
+        {"latency_mean_ms", c.replies + c.exceptions ? c.latency_total / (c.replies + c.exceptions) : 0},
+        {"latency_max_ms", c.latency_max},
+        {"window", c.window_len},
+    };
+
+    for (const auto &counter : counters) {
+        w.key(counter.key);
+        w.u32(counter.value);
+        w.raw(',');
+    }
+    w.key("ratio");
+    w.fixed(c.ratio(), 3);
+}
+
+static void watchdogJson(JsonWriter &w, const WatchdogStats &s) {
+    const struct {
+        const char *key;
+        uint32_t value;
+    } counters[] = {
+        {"interval_ms", WATCHDOG_INTERVAL_MS},
+        {"polls", s.polls},
+        {"failures", s.failures},
+        {"triggers", s.triggers},
+        {"busy_ms", (uint32_t)(s.busy_us / 1000)},
+        {"mean_ms", s.polls ? (uint32_t)(s.busy_us / s.polls / 1000) : 0},
+        {"max_ms", s.max_us / 1000},
+    };
+
+    for (const auto &counter : counters) {
+        w.key(counter.key);
+        w.u32(counter.value);
+        w.raw(',');
+    }
+
+    // Bus share of the watchdog, and of the full reads for comparison
+    w.key("load");
+    w.fixed(s.load(), 3);
+    w.raw(',');
+    w.key("read_load");
+    w.fixed(s.read_load, 3);
+}
+
+static void intervalJson(JsonWriter &w, const ReadIntervalStats &s) {
+    const struct {
+        const char *key;
+        float value;
+        uint8_t decimals;
+    } values[] = {
+        {"interval", s.interval, 1},
+        {"target", s.target, 1},
+        {"p95", s.p95, 2},
+        {"ratio", s.ratio, 3},
+        {"duty", s.duty, 3},
+        {"duty_target", READ_DUTY_TARGET, 3},
+    };
+
+    for (const auto &value : values) {
+        w.key(value.key);
+        w.fixed(value.value, value.decimals);
+        w.raw(',');
+    }
+    w.key("samples");
+    w.u32(s.samples);
+    w.raw(',');
+    w.key("hold");
+    w.u32(s.hold);
+    w.raw(',');
+    w.key("changes");
+    w.u32(s.changes);
+    w.raw(',');
+
+    // Newest first
+    w.key("decisions");
+    w.raw('[');
+    for (uint8_t i = 0; i < s.decisionCount; i++) {
+        const IntervalDecision &d = s.decisions[i];
+        if (i) {
+            w.raw(',');
+        }
+        w.raw('{');
+        w.key("uptime");
+        w.u32(d.uptime);
+        w.raw(',');
+        w.key("reason");
+        w.str(intervalReasonName(d.reason));
+        w.raw(',');
+        w.key("from");
+        w.fixed(d.from, 1);
+        w.raw(',');
+        w.key("to");
+        w.fixed(d.to, 1);
+        w.raw(',');
+        w.key("p95");
+        w.fixed(d.p95, 2);
+        w.raw(',');
+        w.key("ratio");
+        w.fixed(d.ratio, 3);
+        w.raw('}');
+    }
+    w.raw(']');
+}
+
+void modbusJson(JsonWriter &w, const ModbusLinkStats &stats, uint8_t chunkSize, uint8_t chunkSizeMax,
+                const WatchdogStats &watchdog, const ReadIntervalStats &interval) {
+    w.raw('{');
+    w.key("since");
+    w.u32(stats.since);
+    w.raw(',');
+    w.key("chunk_size");
+    w.u32(chunkSize);
+    w.raw(',');
+    w.key("chunk_size_max");
+    w.u32(chunkSizeMax);
+    w.raw(',');
+    w.key("retries");
+    w.u32(RETRY_COUNT);
+    w.raw(',');
+    w.key("timeout_ms");
+    w.u32(MODBUS_TIMEOUT_MS);
+    w.raw(',');
+    w.key("link");
+    w.raw('{');
+    countersJson(w, stats.total);
+    w.raw("},");
+
+    // Non-cumulative buckets, le null is the open-ended last one
+    w.key("latency");
+    w.raw('[');
+    for (uint8_t i = 0; i < MODBUS_LATENCY_BUCKETS; i++) {
+        if (i) {
+            w.raw(',');
+        }
+        w.raw('{');
+        w.key("le");
+        if (i < MODBUS_LATENCY_BUCKETS - 1) {
+            w.u32(modbus_latency_bounds[i]);
+        } else {
+            w.raw("null");
+        }
+        w.raw(',');
+        w.key("count");
+        w.u32(stats.latency[i]);
+        w.raw('}');
+    }
+    w.raw("],");
+
+    w.key("chunks");
+    w.raw('[');
+    for (uint8_t i = 0; i < stats.chunkCount; i++) {
+        const ModbusChunkStats &c = stats.chunks[i];
+        if (i) {
+            w.raw(',');
+        }
+        w.raw('{');
+        w.key("function");
+        w.u32(c.function);
+        w.raw(',');
+        w.key("address");
+        w.u32(c.address);
+        w.raw(',');
+        w.key("count");
+        w.u32(c.count);
+        w.raw(',');
+        countersJson(w, c.counters);
+        w.raw('}');
+    }
+    w.raw("],");
+    w.key("untracked");
+    w.u32(stats.untracked);
+    w.raw(',');
+    w.key("watchdog");
+    w.raw('{');
+    watchdogJson(w, watchdog);
+    w.raw("},");
+    w.key("read_interval");
+    w.raw('{');
+    intervalJson(w, interval);
+    w.raw("}}");
+}
+
+void settingWriteJson(JsonWriter &w, const SettingWrite &job) {
+    w.raw('{');
+    w.key("id");
+    w.u32(job.id);
+    w.raw(',');
+    w.key("key");
+    w.str(inverter_settings[job.setting].key);
+    w.raw(',');
+    w.key("value");
+    w.u32(job.value);
+    w.raw(',');
+    w.key("state");
+    w.str(settingWriteStateName(job.state));
+    w.raw(',');
+    w.key("result");
+    w.u32(job.result);
+    w.raw(',');
+    w.key("readback");
+    if (job.state == WRITE_DONE || job.state == WRITE_MISMATCH) {
+        w.u32(job.readback);
+    } else {
+        w.raw("null");
+    }
+    w.raw(',');
+    w.key("queued");
+    w.u32(job.queued);
+    w.raw(',');
+    w.key("finished");
+    w.u32(job.finished);
+    w.raw('}');
+}
+
+void settingsJson(JsonWriter &w, const SettingWrite *writes, uint8_t count) {
+    w.raw('{');
+    w.key("interval");
+    w.u32(SETTING_WRITE_INTERVAL);
+    w.raw(',');
+    w.key("settings");
+    w.raw('[');
+    for (uint8_t i = 0; i < INVERTER_SETTINGS; i++) {
+        const InverterSetting &s = inverter_settings[i];
+        if (i) {
+            w.raw(',');
+        }
+        w.raw('{');
+        w.key("key");
+        w.str(s.key);
+        w.raw(',');
+        w.key("name");
+        w.str(s.name);
+        w.raw(',');
+        w.key("register");
+        w.u32(s.address);
+        w.raw(',');
+        w.key("readback");
+        w.u32(s.readback);
+        w.raw(',');
+        w.key("min");
+        w.u32(s.min);
+        w.raw(',');
+        w.key("max");
+        w.u32(s.max);
+        if (s.choices[0]) {
+            w.raw(',');
+            w.key("choices");
+            w.raw('[');
+            for (uint8_t c = 0; c < SETTING_CHOICES_MAX && s.choices[c]; c++) {
+                if (c) {
+                    w.raw(',');
+                }
+                w.u32(s.choices[c]);
+            }
+            w.raw(']');
+        }
+        w.raw('}');
+    }
+    w.raw("],");
+    w.key("writes");
+    w.raw('[');
+    for (uint8_t i = 0; i < count; i++) {
+        if (i) {
+            w.raw(',');
+        }
+        settingWriteJson(w, writes[i]);
+    }
+    w.raw("]}");
+}
+
+void eventJson(JsonWriter &w, const Event &e) {
+    w.raw('{');
+    w.key("id");
+    w.u32(e.id);
+    w.raw(',');
+    w.key("type");
+    w.str(eventName(e.type));
+    w.raw(',');
+    w.key("code");
+    w.u32(e.code);
+    w.raw(',');
+    w.key("seq");
+    w.u32(e.seq);
+    w.raw(',');
+    w.key("uptime");
+    w.u32(e.uptime);
+    w.raw(',');
+    w.key("time");
+    w.u32(e.time);
+    w.raw('}');
 }
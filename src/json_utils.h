@@ -5,9 +5,77 @@
 #define JSON_UTILS_H
 
 #include <Arduino.h>
-#include <ArduinoJson.h>
+#include "snapshot.h"
+#include "status_fields.h"
+#include "modbus_rtu.h"
+#include "events.h"
+#include "watchdog.h"
+#include "settings.h"
+#include "read_interval.h"
 
-// Generate JSON string from inverter data
-String dataJson();
+// Append-only JSON writer into a caller buffer, never allocates.
+// With skip > 0 the first skip bytes are counted but dropped, so a chunked
+// response can render the document again and keep only its window.
+class JsonWriter {
+public:
+  JsonWriter(char *buf, size_t size, size_t skip = 0) : buf(buf), size(size), skip(skip) {}
+
+  void raw(const char *s);
+  void raw(char c);
+  void str(const char *s);
+  void key(const char *k);
+  void u32(uint32_t v);
+  void fixed(float v, uint8_t precision);
+  // scaled / 10^precision, as fixed() writes it
+  void decimal(bool negative, uint32_t scaled, uint8_t precision);
+  void value(const Snapshot &snap, const StatusField &f);
+  void field(const Snapshot &snap, const StatusField &f);
+
+  size_t length() const { return len; }
+  size_t available() const { return size - len; }
+  bool full() const { return overflow; }
+
+private:
+  char *buf;
+  size_t size;
+  size_t skip;
+  size_t pos = 0;   // Bytes produced, including skipped ones
+  size_t len = 0;   // Bytes stored in buf
+  bool overflow = false;
+};
+
+// Serialize a sample into buf as a C string, returns the length or 0 if it
+// did not fit
+size_t statusJson(const Snapshot &snap, char *buf, size_t size);
+
+enum StatusFormat : uint8_t {
+  STATUS_JSON,
+  STATUS_CBOR,
+  STATUS_FORMATS,
+};
+
+// Status payload of the latest sample and its ETag, serialized once per sample
+const char *statusPayload(StatusFormat format, size_t &len, const char *&etag);
+
+// Dashboard metadata (names, units, descriptions) from the status fields table
+void namesJson(JsonWriter &w);
+
+// Field id, section, key, type and unit of each /api/status.cbor entry
+void fieldsJson(JsonWriter &w);
+
+// One inverter event as an object
+void eventJson(JsonWriter &w, const Event &e);
+
+// One setting write and its outcome as an object
+void settingWriteJson(JsonWriter &w, const SettingWrite &job);
+
+// Writable settings with their ranges, and the writes still in the ring
+void settingsJson(JsonWriter &w, const SettingWrite *writes, uint8_t count);
+
+// Modbus link quality: totals, reply latency histogram, per chunk counters,
+// the bus time of the outage watchdog and the read interval controller. The
+// chunk sizes are passed in like the rest, copied once per response.
+void modbusJson(JsonWriter &w, const ModbusLinkStats &stats, uint8_t chunkSize, uint8_t chunkSizeMax,
+                const WatchdogStats &watchdog, const ReadIntervalStats &interval);
 
 #endif // JSON_UTILS_H
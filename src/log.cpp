@@ -0,0 +1,203 @@
+// Logger implementation
+// Records are [length, 1 byte][module << 4 | level][millis, 4 bytes][text]
+// in a byte ring. A writer formats on its own stack first and holds the
+// lock only to copy the record in; when the ring is full the oldest
+// records make room. The drain task copies one record out at a time and
+// does the slow Serial/WebSerial writes without the lock.
+
+#include "log.h"
+#include "config.h"
+#include <stdarg.h>
+#ifdef WEBSERIAL
+  #include <WebSerial.h>
+#endif
+
+#ifdef NATIVE
+  #define LOG_LOCK()
+  #define LOG_UNLOCK()
+#else
+  static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+  #define LOG_LOCK() portENTER_CRITICAL(&logMux)
+  #define LOG_UNLOCK() portEXIT_CRITICAL(&logMux)
+#endif
+
+#define RECORD_HEADER 6
+
+static_assert(LOG_LINE_MAX < 256, "record length is one byte");
+static_assert(LOG_BUFFER_BYTES >= RECORD_HEADER + LOG_LINE_MAX, "the ring must hold the longest record");
+
+static const char *module_names[] = {
+  "main", "wifi", "ota", "web", "modbus", "energy", "history", "samples", "mqtt", "influx",
+  "events", "settings",
+};
+static_assert(sizeof(module_names) / sizeof(module_names[0]) == LOG_MODULES, "one name per LogModule");
+
+static const char *level_names[LOG_LEVELS] = {"off", "error", "warn", "info", "debug"};
+static const char level_tags[LOG_LEVELS] = {' ', 'E', 'W', 'I', 'D'};
+
+volatile uint8_t log_levels[LOG_MODULES];
+
+// Every module starts at LOG_LEVEL, filled here so a new module cannot be
+// left out (and silently off). Runs before setup(), nothing logs earlier.
+static struct LogLevelsInit {
+  LogLevelsInit() {
+    for (uint8_t m = 0; m < LOG_MODULES; m++) {
+      log_levels[m] = LOG_LEVEL;
+    }
+  }
+} logLevelsInit;
+
+static uint8_t ring[LOG_BUFFER_BYTES];
+static size_t ringHead = 0;
+static size_t ringUsed = 0;
+static LogStats stats;
+#ifndef NATIVE
+  static TaskHandle_t drainTask = NULL;
+#endif
+
+// Lock held
+static void popRecord() {
+  size_t len = RECORD_HEADER + ring[ringHead];
+  ringHead = (ringHead + len) % LOG_BUFFER_BYTES;
+  ringUsed -= len;
+}
+
+static void writeLine(uint8_t tag, unsigned long ms, const char *text) {
+  uint8_t module = tag >> 4;
+  uint8_t level = tag & 0x0F;
+  char line[LOG_LINE_MAX + 32];
+  snprintf(line, sizeof(line), "[%6lu.%03lu] %c %s: %s", ms / 1000, ms % 1000,
+           level_tags[level < LOG_LEVELS ? level : 0], logModuleName(module), text);
+
+  Serial.println(line);
+  #if defined(WEBSERIAL) && !defined(NATIVE)
+    WebSerial.println(line);
+  #endif
+}
+
+void logPrintf(LogModule module, LogLevel level, const char *format, ...) {
+  char text[LOG_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (n < 0) {
+    return;
+  }
+  uint8_t tag = (module << 4) | level;
+
+  #ifdef NATIVE
+    // Single threaded, no drain task: straight to stderr
+    stats.written++;
+    writeLine(tag, millis(), text);
+  #else
+    uint8_t len = min((size_t)n, sizeof(text) - 1);
+    uint32_t ms = millis();
+    uint8_t header[RECORD_HEADER] = {len, tag, (uint8_t)(ms >> 24), (uint8_t)(ms >> 16), (uint8_t)(ms >> 8), (uint8_t)ms};
+
+    LOG_LOCK();
+    while (LOG_BUFFER_BYTES - ringUsed < (size_t)(RECORD_HEADER + len)) {
+      popRecord();
+      stats.dropped++;
+    }
+    size_t tail = ringHead + ringUsed;
+    for (uint8_t i = 0; i < RECORD_HEADER; i++) {
+      ring[tail++ % LOG_BUFFER_BYTES] = header[i];
+    }
+    for (uint8_t i = 0; i < len; i++) {
+      ring[tail++ % LOG_BUFFER_BYTES] = text[i];
+    }
+    ringUsed += RECORD_HEADER + len;
+    stats.written++;
+    LOG_UNLOCK();
+
+    if (drainTask) {
+      xTaskNotifyGive(drainTask);
+    }
+  #endif
+}
+
+void logDrain() {
+  static uint32_t reportedDrops = 0;
+
+  for (;;) {
+    uint8_t header[RECORD_HEADER];
+    char text[LOG_LINE_MAX];
+    uint32_t dropped;
+
+    LOG_LOCK();
+    if (!ringUsed) {
+      LOG_UNLOCK();
+      return;
+    }
+    for (uint8_t i = 0; i < RECORD_HEADER; i++) {
+      header[i] = ring[(ringHead + i) % LOG_BUFFER_BYTES];
+    }
+    for (uint8_t i = 0; i < header[0]; i++) {
+      text[i] = ring[(ringHead + RECORD_HEADER + i) % LOG_BUFFER_BYTES];
+    }
+    popRecord();
+    dropped = stats.dropped;
+    LOG_UNLOCK();
+
+    if (dropped != reportedDrops) {
+      char note[48];
+      snprintf(note, sizeof(note), "%u messages dropped", (unsigned)(dropped - reportedDrops));
+      writeLine((LOG_MAIN << 4) | LEVEL_WARN, millis(), note);
+      reportedDrops = dropped;
+    }
+
+    text[header[0]] = 0;
+    unsigned long ms = ((uint32_t)header[2] << 24) | ((uint32_t)header[3] << 16) | (header[4] << 8) | header[5];
+    writeLine(header[1], ms, text);
+  }
+}
+
+const char *logModuleName(uint8_t module) {
+  return module < LOG_MODULES ? module_names[module] : "?";
+}
+
+const char *logLevelName(uint8_t level) {
+  return level < LOG_LEVELS ? level_names[level] : "?";
+}
+
+bool logSetLevel(const char *module, const char *level) {
+  uint8_t l = 0;
+  while (l < LOG_LEVELS && strcmp(level, level_names[l]) != 0) {
+    l++;
+  }
+  if (l == LOG_LEVELS) {
+    return false;
+  }
+
+  bool all = strcmp(module, "all") == 0;
+  bool found = false;
+  for (uint8_t m = 0; m < LOG_MODULES; m++) {
+    if (all || strcmp(module, module_names[m]) == 0) {
+      log_levels[m] = l;
+      found = true;
+    }
+  }
+  return found;
+}
+
+LogStats logStats() {
+  LOG_LOCK();
+  LogStats s = stats;
+  s.queued = ringUsed;
+  LOG_UNLOCK();
+  return s;
+}
+
+#ifndef NATIVE
+static void logTask(void *param) {
+  for (;;) {
+    logDrain();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+  }
+}
+
+void logSetup() {
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, &drainTask, LOG_TASK_CORE);
+}
+#endif
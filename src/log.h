@@ -0,0 +1,83 @@
+// Logger header
+// Leveled log with a threshold per module, adjustable at runtime. Messages
+// are formatted into a ring buffer and written out to Serial and WebSerial
+// by a low priority task, so logging never blocks the caller on I/O.
+//
+// Each .cpp sets its module before using the macros:
+//   #define LOG_MODULE LOG_MODBUS
+//   LOGI("Chunk size probed: %u", chunk_size);
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+enum LogLevel : uint8_t {
+  LEVEL_OFF,
+  LEVEL_ERROR,
+  LEVEL_WARN,
+  LEVEL_INFO,
+  LEVEL_DEBUG,
+  LOG_LEVELS,
+};
+
+enum LogModule : uint8_t {
+  LOG_MAIN,
+  LOG_WIFI,
+  LOG_OTA,
+  LOG_WEB,
+  LOG_MODBUS,
+  LOG_ENERGY,
+  LOG_HISTORY,
+  LOG_SAMPLES,
+  LOG_MQTT,
+  LOG_INFLUX,
+  LOG_EVENTS,
+  LOG_SETTINGS,
+  LOG_MODULES,
+};
+
+struct LogStats {
+  uint32_t written;   // Messages queued
+  uint32_t dropped;   // Oldest messages dropped from a full ring
+  size_t queued;      // Bytes waiting to be written out
+};
+
+extern volatile uint8_t log_levels[LOG_MODULES];
+
+inline bool logEnabled(LogModule module, LogLevel level) {
+  return level <= log_levels[module];
+}
+
+// Queue a message, without the trailing newline
+void logPrintf(LogModule module, LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define LOG_AT(level, ...) \
+  do { \
+    if (logEnabled(LOG_MODULE, level)) { \
+      logPrintf(LOG_MODULE, level, __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define LOGE(...) LOG_AT(LEVEL_ERROR, __VA_ARGS__)
+#define LOGW(...) LOG_AT(LEVEL_WARN, __VA_ARGS__)
+#define LOGI(...) LOG_AT(LEVEL_INFO, __VA_ARGS__)
+#define LOGD(...) LOG_AT(LEVEL_DEBUG, __VA_ARGS__)
+
+// Start the drain task, messages logged before are kept until then
+void logSetup();
+
+// Write out queued messages, drain task only (host build: nothing queued)
+void logDrain();
+
+// Module and level names as used in the API and the WebSerial command
+const char *logModuleName(uint8_t module);
+const char *logLevelName(uint8_t level);
+
+// Set the level of a module by name, "all" for every module. False for an
+// unknown module or level.
+bool logSetLevel(const char *module, const char *level);
+
+LogStats logStats();
+
+#endif // LOG_H
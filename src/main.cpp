@@ -10,8 +10,6 @@
 #include <ArduinoOTA.h>
 #include <FS.h>
 #include <SPIFFS.h>
-#include <ArduinoJson.h>
-#include <ModbusMaster.h>
 #include <Preferences.h>
 #include <ESPAsyncWebServer.h>
 #include <WebSerial.h>
@@ -22,32 +20,43 @@
 #include "data.h"
 #include "globals.h"
 #include "utils.h"
+#include "log.h"
+#include "scheduler.h"
 #include "modbus.h"
+#include "acquisition.h"
+#include "history.h"
+#include "sample_log.h"
+#include "mqtt.h"
+#include "influx.h"
+#include "assets.h"
 #include "energy.h"
 #include "webserver.h"
 #include "ota.h"
 #include "wifi.h"
-#include "wifi_creds.h"
 
 // ==================== GLOBAL VARIABLES ====================
 
 // Preferences for persistent storage
 Preferences prefs;
 
-// Modbus node
-ModbusMaster node;
+// Modbus master
+ModbusRtu mbus;
 uint16_t mbusData[MBUS_REGISTERS + 1];
 
+// Adaptive chunk size: current and largest the inverter accepted
+uint8_t chunk_size = CHUNK_SIZE_MIN;
+uint8_t chunk_size_max = CHUNK_SIZE_MAX;
+
 // Web server
 AsyncWebServer server(80);
+AsyncEventSource events("/api/stream");
 IPAddress myIp;
 
 // WiFi status: 0 = client, 1 = AP
 bool wifiMode = 0;
 
-// Timing variables
-unsigned long lastSendRequestTime = 0;
-unsigned long lastWifiCheckTime = 0;
+// Timed jobs of loop(), sendRequest() has its own in the acquisition task
+Scheduler loopJobs("loop");
 
 // Dynamic read interval
 float dynamic_read_interval = INITIAL_READ_INTERVAL;
@@ -64,21 +73,13 @@ ACData ac;
 DCData dc;
 InverterData inverter;
 
-// ==================== PRINT MACROS ====================
-
-// Print macros
-#ifdef WEBSERIAL
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
+#define LOG_MODULE LOG_MAIN
 
 // ==================== SETUP ====================
 
 void setup() {
   Serial.begin(MONITOR_SERIAL_SPEED);
+  logSetup();
 
   doWifi();
 
@@ -89,47 +90,45 @@ void setup() {
   otaSetup();
   ArduinoOTA.begin();
 
-  sprintln("OTA ready");
+  LOGI("OTA ready");
 
   mdnsSetup();
 
-  sprint("Firmware version: ");
-  sprintln(VERSION);
+  LOGI("Firmware version: %.1f", VERSION);
 
   if (!SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED)) {
-    sprintln("SPIFFS Mount Failed");
+    LOGE("SPIFFS Mount Failed");
   } else {
-    sprintln("SPIFFS init OK");
+    LOGI("SPIFFS init OK");
+    sampleLogSetup();
   }
+  assetsSetup();
 
   nodeSetup();
+  historySetup();
+  acquisitionSetup();
+
+  #ifdef MQTT_ENABLED
+    mqttSetup();
+  #endif
 
-  // Initialize timing variables for manual timer replacement
-  lastSendRequestTime = millis();
-  lastWifiCheckTime = millis();
+  #ifdef INFLUX_ENABLED
+    influxSetup();
+  #endif
 
-  sprintln("Ready to rock...");
+  loopJobs.every("wifi", WIFI_CHECK_INTERVAL * 1000UL, checkWifi);
+  loopJobs.every("sample_log", SAMPLE_LOG_FLUSH_INTERVAL * 1000UL, sampleLogFlush);
+
+  LOGI("Ready to rock...");
 }
 
 // ==================== LOOP ====================
 
 void loop() {
   ArduinoOTA.handle();
-
-  // Manual timing checks (replacing SimpleTimer)
-  unsigned long currentTime = millis();
-
-  // Check if it's time to call sendRequest
-  if (hasTimeElapsed(lastSendRequestTime, currentTime, uint16_t(dynamic_read_interval * 1000))) {
-    lastSendRequestTime = currentTime;
-    sendRequest();
-  }
-
-  // Check if it's time to call checkWifi (every 3 minutes)
-  if (hasTimeElapsed(lastWifiCheckTime, currentTime, 3 * 60 * 1000UL)) {
-    lastWifiCheckTime = currentTime;
-    checkWifi();
-  }
+  webserverLoop();
+  sampleLogLoop();
+  loopJobs.run();
 
   delay(1);
 }
@@ -0,0 +1,257 @@
+// Prometheus metrics implementation
+// Metric names are powmr_<section>_<key>, gauges in the status fields' own
+// units. One metric family is rendered at a time into the query's item
+// buffer and copied out across as many chunks as it needs, so a scrape
+// costs the same per metric whatever the chunk size and metric count.
+
+#include <WiFi.h>
+#include "metrics.h"
+#include "config.h"
+#include "globals.h"
+#include "modbus.h"
+#include "watchdog.h"
+#include "read_interval.h"
+#include "utils.h"
+#include "status_fields.h"
+#include "json_utils.h"
+#ifdef MQTT_ENABLED
+  #include "mqtt.h"
+#endif
+#ifdef INFLUX_ENABLED
+  #include "influx.h"
+#endif
+
+enum MetricsStage : uint8_t {
+  STAGE_FIELDS,
+  STAGE_RAW,
+  STAGE_GROUPS,
+  STAGE_HEALTH,
+  STAGE_DONE,
+};
+
+// Unfiltered readings kept next to the published values, not in /api/status
+struct RawMetric {
+  const char *name;
+  uint16_t offset;
+  const char *help;
+};
+
+static const RawMetric raw_metrics[] = {
+  {"powmr_dc_voltage_raw", offsetof(Snapshot, dc.voltage_), "Battery voltage before filtering, V"},
+  {"powmr_dc_charge_current_raw", offsetof(Snapshot, dc.charge_current_), "Charge current before filtering, A"},
+  {"powmr_dc_discharge_current_raw", offsetof(Snapshot, dc.discharge_current_), "Discharge current before filtering, A"},
+  {"powmr_dc_charged_voltage", offsetof(Snapshot, dc.charged_voltage), "Battery voltage considered fully charged, V"},
+};
+
+// Device and publisher health, read when the metric is rendered
+struct HealthMetric {
+  const char *name;
+  const char *type;
+  const char *help;
+  double (*value)();
+};
+
+static const HealthMetric health_metrics[] = {
+  {"powmr_samples_total", "counter", "Samples published",
+   []() -> double { return snapshotSeq(); }},
+  {"powmr_modbus_pending", "gauge", "Modbus requests queued",
+   []() -> double { return mbus.pending(); }},
+  {"powmr_modbus_consecutive_failures", "gauge", "Acquisition cycles failed in a row",
+   []() -> double { return consecutive_failures; }},
+  {"powmr_modbus_attempts_total", "counter", "Modbus frames sent, retries included",
+   []() -> double { return mbus.linkCounters().attempts; }},
+  {"powmr_modbus_timeouts_total", "counter", "Modbus attempts without a reply",
+   []() -> double { return mbus.linkCounters().timeouts; }},
+  {"powmr_modbus_crc_errors_total", "counter", "Modbus replies with a bad CRC",
+   []() -> double { return mbus.linkCounters().crc_errors; }},
+  {"powmr_modbus_exceptions_total", "counter", "Modbus exception replies",
+   []() -> double { return mbus.linkCounters().exceptions; }},
+  {"powmr_modbus_failures_total", "counter", "Modbus requests failed after every retry",
+   []() -> double { return mbus.linkCounters().failures; }},
+  {"powmr_modbus_success_ratio", "gauge", "Share of good replies over the last 64 attempts",
+   []() -> double { return mbus.linkCounters().ratio(); }},
+  {"powmr_watchdog_polls_total", "counter", "Outage watchdog polls of the status words",
+   []() -> double { WatchdogStats s; watchdogStats(s); return s.polls; }},
+  {"powmr_watchdog_triggers_total", "counter", "Status flag changes seen by the outage watchdog",
+   []() -> double { WatchdogStats s; watchdogStats(s); return s.triggers; }},
+  {"powmr_watchdog_bus_load", "gauge", "Share of the time the Modbus bus spent on watchdog polls",
+   []() -> double { WatchdogStats s; watchdogStats(s); return s.load(); }},
+  {"powmr_read_bus_duty", "gauge", "Share of the time the Modbus bus spent on full reads",
+   []() -> double { ReadIntervalStats s; readIntervalStats(s); return s.duty; }},
+  {"powmr_read_interval_changes_total", "counter", "Read interval changes made by the controller",
+   []() -> double { ReadIntervalStats s; readIntervalStats(s); return s.changes; }},
+  {"powmr_heap_free_bytes", "gauge", "Free heap",
+   []() -> double { return ESP.getFreeHeap(); }},
+  {"powmr_heap_min_free_bytes", "gauge", "Lowest free heap since boot",
+   []() -> double { return ESP.getMinFreeHeap(); }},
+  {"powmr_heap_max_alloc_bytes", "gauge", "Largest allocatable heap block",
+   []() -> double { return ESP.getMaxAllocHeap(); }},
+  {"powmr_wifi_rssi_dbm", "gauge", "WiFi signal strength",
+   []() -> double { return WiFi.RSSI(); }},
+  #ifdef MQTT_ENABLED
+  {"powmr_mqtt_connected", "gauge", "1 while connected to the MQTT broker",
+   []() -> double { return mqttStats().connected; }},
+  {"powmr_mqtt_published_total", "counter", "MQTT messages published",
+   []() -> double { return mqttStats().published; }},
+  {"powmr_mqtt_dropped_total", "counter", "MQTT messages dropped from a full queue",
+   []() -> double { return mqttStats().dropped; }},
+  {"powmr_mqtt_queued_bytes", "gauge", "MQTT queue backlog",
+   []() -> double { return mqttStats().queued; }},
+  #endif
+  #ifdef INFLUX_ENABLED
+  {"powmr_influx_written_total", "counter", "Samples written to InfluxDB",
+   []() -> double { return influxStats().written; }},
+  {"powmr_influx_dropped_total", "counter", "Samples dropped before reaching InfluxDB",
+   []() -> double { return influxStats().dropped; }},
+  {"powmr_influx_failures_total", "counter", "Failed InfluxDB writes",
+   []() -> double { return influxStats().failures; }},
+  {"powmr_influx_spooled", "gauge", "Samples waiting for InfluxDB",
+   []() -> double { return influxStats().spooled; }},
+  #endif
+};
+
+#define RAW_METRICS (sizeof(raw_metrics) / sizeof(raw_metrics[0]))
+#define HEALTH_METRICS (sizeof(health_metrics) / sizeof(health_metrics[0]))
+
+static void helpLine(JsonWriter &w, const char *name) {
+  w.raw("# HELP ");
+  w.raw(name);
+  w.raw(' ');
+}
+
+static void typeLine(JsonWriter &w, const char *name, const char *type) {
+  w.raw("\n# TYPE ");
+  w.raw(name);
+  w.raw(' ');
+  w.raw(type);
+  w.raw('\n');
+}
+
+static void number(JsonWriter &w, double v, uint8_t digits) {
+  char text[24];
+  if (isnan(v)) {
+    w.raw("NaN");
+  } else if (isinf(v)) {
+    w.raw(v > 0 ? "+Inf" : "-Inf");
+  } else {
+    snprintf(text, sizeof(text), "%.*g", digits, v);
+    w.raw(text);
+  }
+}
+
+static void renderField(JsonWriter &w, const Snapshot &snap, const StatusField &f) {
+  char name[64];
+  snprintf(name, sizeof(name), "powmr_%s_%s", status_sections[f.section].key, f.key);
+
+  helpLine(w, name);
+  w.raw(f.name);
+  if (f.unit[0]) {
+    w.raw(", ");
+    w.raw(f.unit);
+  }
+  typeLine(w, name, "gauge");
+  w.raw(name);
+  w.raw(' ');
+  if (isfinite(fieldValue(snap, f))) {
+    w.value(snap, f);
+  } else {
+    w.raw("NaN");
+  }
+  w.raw('\n');
+}
+
+// Render the next metric family into the item buffer
+static void nextItem(MetricsQuery &q) {
+  JsonWriter w(q.item, sizeof(q.item));
+
+  for (;;) {
+    switch (q.stage) {
+      case STAGE_FIELDS:
+        if (q.cursor < STATUS_FIELDS) {
+          renderField(w, q.snap, status_fields[q.cursor++]);
+          break;
+        }
+        q.stage = STAGE_RAW;
+        q.cursor = 0;
+        continue;
+
+      case STAGE_RAW:
+        if (q.cursor < RAW_METRICS) {
+          const RawMetric &m = raw_metrics[q.cursor++];
+          helpLine(w, m.name);
+          w.raw(m.help);
+          typeLine(w, m.name, "gauge");
+          w.raw(m.name);
+          w.raw(' ');
+          number(w, *(const float *)((const uint8_t *)&q.snap + m.offset), 6);
+          w.raw('\n');
+          break;
+        }
+        q.stage = STAGE_GROUPS;
+        q.cursor = 0;
+        continue;
+
+      case STAGE_GROUPS:
+        helpLine(w, "powmr_register_group_reads_total");
+        w.raw("Good reads of each Modbus register group");
+        typeLine(w, "powmr_register_group_reads_total", "counter");
+        for (uint8_t i = 0; i < REG_GROUPS; i++) {
+          w.raw("powmr_register_group_reads_total{group=\"");
+          w.raw(reg_groups[i].name);
+          w.raw("\"} ");
+          w.u32(reg_groups[i].reads);
+          w.raw('\n');
+        }
+        q.stage = STAGE_HEALTH;
+        q.cursor = 0;
+        break;
+
+      case STAGE_HEALTH:
+        if (q.cursor < HEALTH_METRICS) {
+          const HealthMetric &m = health_metrics[q.cursor++];
+          helpLine(w, m.name);
+          w.raw(m.help);
+          typeLine(w, m.name, m.type);
+          w.raw(m.name);
+          w.raw(' ');
+          number(w, m.value(), 10);
+          w.raw('\n');
+          break;
+        }
+        q.stage = STAGE_DONE;
+        break;
+
+      default:
+        break;
+    }
+    break;
+  }
+
+  // A truncated family would corrupt the exposition, leave it out
+  q.itemLen = w.full() ? 0 : w.length();
+  q.itemSent = 0;
+}
+
+void metricsQuery(MetricsQuery &q) {
+  readSnapshot(q.snap);
+  q.stage = STAGE_FIELDS;
+  q.cursor = 0;
+  q.itemLen = 0;
+  q.itemSent = 0;
+}
+
+size_t metricsRead(MetricsQuery &q, char *buf, size_t size) {
+  size_t len = 0;
+
+  for (;;) {
+    size_t n = min((size_t)(q.itemLen - q.itemSent), size - len);
+    memcpy(buf + len, q.item + q.itemSent, n);
+    len += n;
+    q.itemSent += n;
+
+    if (q.itemSent < q.itemLen || q.stage == STAGE_DONE) {
+      return len;
+    }
+    nextItem(q);
+  }
+}
@@ -0,0 +1,27 @@
+// Prometheus metrics header
+// Text exposition of every status field plus Modbus, heap and publisher
+// health, streamed a metric at a time for /metrics
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+
+// State of one /metrics response, advanced chunk by chunk
+struct MetricsQuery {
+  Snapshot snap;      // Sample taken when the scrape started
+  uint8_t stage;      // Status fields, raw readings, register groups, health, done
+  uint8_t cursor;     // Next entry of the stage
+  char item[384];     // Rendered metric not fully sent yet
+  uint16_t itemLen;
+  uint16_t itemSent;
+};
+
+// Start a scrape on the latest sample
+void metricsQuery(MetricsQuery &q);
+
+// Write the next part of the exposition, 0 when it is complete
+size_t metricsRead(MetricsQuery &q, char *buf, size_t size);
+
+#endif // METRICS_H
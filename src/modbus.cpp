@@ -5,157 +5,269 @@
 #include "globals.h"
 #include "utils.h"
 #include "energy.h"
+#include "log.h"
+#include "perf.h"
+#include "status_fields.h"
+#include "read_interval.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
-
-// Idle callback for Modbus
-void idle() {
-  delay(1);
-  yield();
-}
+#define LOG_MODULE LOG_MODBUS
 
 // Initialize Modbus serial connection
 void nodeSetup() {
-  Serial1.begin(2400, SERIAL_8N1, RXD2, TXD2);
-  sprintln("Using Hardware Serial1");
+  Serial1.begin(MBUS_BAUD, SERIAL_8N1, RXD2, TXD2);
   if (Serial1) {
-    sprintln("Serial1 init ok");
+    LOGI("Serial1 init ok");
   } else {
-    sprintln("Serial1 init problem !!!");
+    LOGE("Serial1 init problem !!!");
+  }
+
+  mbus.begin(MBUS_SLAVE_ID, Serial1, MBUS_BAUD);
+
+  loadChunkSize();
+}
+
+// Read one chunk and wait for it
+static uint8_t readChunk(uint16_t addr, uint16_t regs, uint16_t *data, uint8_t retries) {
+  ModbusFuture future;
+  ModbusRequest req = ModbusRtu::readRequest(addr, regs, data);
+  req.retries = retries;
+  req.future = &future;
+
+  if (!mbus.submit(req)) {
+    LOGE("Modbus queue full");
+    return 0;
   }
 
-  node.begin(5, Serial1);
-  node.idle(idle);
+  uint8_t result = mbus.await(future);
+  if (result != MB_SUCCESS) {
+    LOGW("Failed to read %u regs at addr %u, result 0x%X", regs, addr, result);
+    return 0;
+  }
+  return 1;
 }
 
-// Read registers in chunks with retry logic
+// Load the chunk size found for this inverter, 0 if never probed
+void loadChunkSize() {
+  prefs.begin("modbus", true);
+  if (prefs.isKey("chunk_size")) {
+    chunk_size = prefs.getUChar("chunk_size", CHUNK_SIZE_MIN);
+    chunk_size_max = prefs.getUChar("chunk_max", chunk_size);
+  } else {
+    chunk_size = 0;
+  }
+  prefs.end();
+
+  if (chunk_size) {
+    LOGI("Loaded chunk size: %u (max %u)", chunk_size, chunk_size_max);
+  }
+}
+
+// Persist the chunk sizes, only when they changed
+static void saveChunkSize() {
+  static uint8_t saved_size = 0;
+  static uint8_t saved_max = 0;
+
+  if (chunk_size == saved_size && chunk_size_max == saved_max) {
+    return;
+  }
+
+  prefs.begin("modbus", false);
+  prefs.putUChar("chunk_size", chunk_size);
+  prefs.putUChar("chunk_max", chunk_size_max);
+  prefs.end();
+
+  saved_size = chunk_size;
+  saved_max = chunk_size_max;
+
+  LOGD("Chunk size saved to Preferences: %u", chunk_size);
+}
+
+// Find the largest read the inverter answers: binary search between
+// CHUNK_SIZE_MIN and CHUNK_SIZE_MAX, trying the whole block first
+uint8_t probeChunkSize() {
+  uint8_t good = CHUNK_SIZE_MIN - 1;
+  uint8_t bad = CHUNK_SIZE_MAX + 1;
+  uint8_t size = CHUNK_SIZE_MAX;
+
+  LOGI("Probing Modbus chunk size");
+
+  while (bad - good > 1) {
+    if (readChunk(MBUS_FIRST_REGISTER, size, mbusData, 1)) {
+      good = size;
+    } else {
+      bad = size;
+    }
+    size = (good + bad) / 2;
+    if (size < CHUNK_SIZE_MIN) {
+      size = CHUNK_SIZE_MIN;
+    }
+  }
+
+  // Nothing answered: the link is down, not the size, so try again later
+  if (good < CHUNK_SIZE_MIN) {
+    LOGW("Chunk probe got no answer, reading %u registers at a time until the link is back", CHUNK_SIZE_MIN);
+    return 0;
+  }
+
+  chunk_size = good;
+  chunk_size_max = good;
+  saveChunkSize();
+
+  LOGI("Chunk size probed: %u", chunk_size);
+  return chunk_size;
+}
+
+// The first failed chunk of a batch cancels the ones still queued
+static void chunkDone(const ModbusRequest &req) {
+  if (req.result != MB_SUCCESS) {
+    mbus.cancel(req.tag);
+  }
+}
+
+// Read registers in chunks of chunk_size, all queued at once so the bus
+// goes from one chunk to the next without a round trip through this task.
+// A failed chunk halves chunk_size, a long good streak grows it back
+// towards chunk_size_max.
 uint8_t readRegistersChunked(uint16_t startAddr, uint16_t totalRegs, uint16_t *data) {
-  uint16_t chunks = (totalRegs + CHUNK_SIZE - 1) / CHUNK_SIZE;
-  uint16_t currentAddr = startAddr;
+  static uint16_t good_cycles = 0;
+  uint8_t entry_size = chunk_size;
   uint16_t regsRead = 0;
-  
-  for (uint16_t chunk = 0; chunk < chunks; chunk++) {
-    uint16_t regsToRead = min(CHUNK_SIZE, totalRegs - regsRead);
-    uint8_t attempts = 0;
-    uint8_t success = 0;
-
-    while (attempts <= RETRY_COUNT && !success) {
-      uint8_t result = node.readHoldingRegisters(currentAddr, regsToRead);
-
-      if (result == node.ku8MBSuccess) {
-        for (uint16_t j = 0; j < regsToRead; j++) {
-          data[regsRead + j] = node.getResponseBuffer(j);
-        }
-        success = 1;
+  ModbusFuture futures[(MBUS_REGISTERS + CHUNK_SIZE_MIN - 1) / CHUNK_SIZE_MIN];
+  const uint8_t maxChunks = sizeof(futures) / sizeof(futures[0]);
+
+  while (regsRead < totalRegs) {
+    uint8_t chunks = 0;
+    for (uint16_t offset = regsRead; offset < totalRegs && chunks < maxChunks; offset += chunk_size) {
+      ModbusRequest req = ModbusRtu::readRequest(startAddr + offset,
+                                                 min((int)chunk_size, totalRegs - offset), data + offset);
+      req.retries = RETRY_COUNT;
+      req.tag = MBUS_TAG_CHUNKS;
+      req.callback = chunkDone;
+      req.future = &futures[chunks];
+
+      // Queue full, the rest goes in the next round
+      if (!mbus.submit(req)) {
+        break;
+      }
+      chunks++;
+    }
+
+    if (!chunks) {
+      mbus.poll();
+      mbus.wait();
+      continue;
+    }
+
+    // Results come back in order; everything after a failure is void
+    uint8_t failed = MB_SUCCESS;
+    uint16_t failedAddr = 0;
+    for (uint8_t i = 0; i < chunks; i++) {
+      uint8_t result = mbus.await(futures[i]);
+      if (failed != MB_SUCCESS) {
+        continue;
+      }
+      if (result == MB_SUCCESS) {
+        regsRead += min((int)chunk_size, totalRegs - regsRead);
       } else {
-        attempts++;
-        if (attempts < RETRY_COUNT) {
-          delayMicroseconds(CHUNK_DELAY_US);
-        }
+        failed = result;
+        failedAddr = startAddr + regsRead;
       }
     }
 
-    if (!success) {
-      sprint("Failed to read chunk at addr ");
-      sprint(currentAddr);
-      sprint(" after ");
-      sprint(attempts);
-      sprintln(" attempts");
-      return 0;
+    if (failed == MB_SUCCESS) {
+      continue;
     }
 
-    regsRead += regsToRead;
-    currentAddr += regsToRead;
-    
-    if (chunk < chunks - 1) {
-      delayMicroseconds(CHUNK_DELAY_US);
+    LOGW("Failed to read chunk at addr %u, result 0x%X", failedAddr, failed);
+
+    if (chunk_size > CHUNK_SIZE_MIN) {
+      chunk_size = max(CHUNK_SIZE_MIN, chunk_size / 2);
+      good_cycles = 0;
+
+      LOGW("Falling back to chunk size %u", chunk_size);
+      continue;
     }
+
+    // Even the smallest chunk failed, that is the link and not the size
+    chunk_size = entry_size;
+    return 0;
   }
-  
-  return 1;
-}
 
-// Main function to read inverter data via Modbus
-void sendRequest() {
-  sprintln("==> Reading registers 4501-4561 (61 regs)");
-  unsigned long start = millis();
-  
-  if (!readRegistersChunked(4501, MBUS_REGISTERS, mbusData)) {
-    sprintln("Error reading registers");
-    inverter.valid_info = 0;
-    consecutive_failures++;
-    
-    #ifdef VERBOSE_SERIAL
-      sprint("Consecutive failures: ");
-      sprintln(consecutive_failures);
-    #endif
-    
-    if (consecutive_failures >= MAX_FAILURES) {
-      dynamic_read_interval = INITIAL_READ_INTERVAL;
-      consecutive_failures = 0;
+  saveChunkSize();
 
-      #ifdef VERBOSE_SERIAL
-        sprintln("Max failures reached - reset to 15s interval");
-      #endif
-    }
-    
-    return;
+  if (chunk_size < chunk_size_max && ++good_cycles >= CHUNK_REGROW_CYCLES) {
+    chunk_size = min(chunk_size * 2, (int)chunk_size_max);
+    good_cycles = 0;
+
+    LOGD("Trying bigger chunk size: %u", chunk_size);
   }
 
-  consecutive_failures = 0;
+  return 1;
+}
 
-  unsigned long stop = millis();
-  if (stop > start) {
-    stop -= start;
-    inverter.read_time = (float)stop / 1000.0;
+// Register groups, polled at their own rate (period 0 = every cycle)
+RegisterGroup reg_groups[REG_GROUPS] = {
+  // 4501-4516: mode, AC, PV, battery and load measurements
+  {"measure", 0, 16, 0, 0, 0, 0, false},
+  // 4553-4561: status flags, charger status, temperature
+  {"status", 52, 9, 0, 0, 0, 0, false},
+  // 4517-4552: error code, priorities, charge voltages, equalization
+  {"settings", 16, 36, SETTINGS_POLL_INTERVAL * 1000UL, 0, 0, 0, false},
+  // 4530: fault code, also in settings but wanted every cycle
+  {"fault", 29, 1, 0, 0, 0, 0, false},
+};
+
+// Read the groups that are due, a failed group stays due for the next cycle.
+// Returns 0 if a group polled every cycle could not be read.
+uint8_t readRegisterGroups() {
+  uint64_t now = millis64();
+  uint8_t ok = 1;
+
+  for (uint8_t i = 0; i < REG_GROUPS; i++) {
+    RegisterGroup &g = reg_groups[i];
+
+    if (g.period_ms && g.reads && !g.refresh && now - g.last_read < g.period_ms) {
+      continue;
+    }
 
-    if (!read_time_initialized) {
-      read_time_initialized = true;
-      inverter.read_time_mean = inverter.read_time;
-    } else {
-      calculateEWMA(inverter.read_time_mean, inverter.read_time, calculateDynamicAlpha());
+    LOGD("Reading %s registers %u-%u", g.name, MBUS_FIRST_REGISTER + g.first,
+         MBUS_FIRST_REGISTER + g.first + g.count - 1);
+
+    if (!readRegistersChunked(MBUS_FIRST_REGISTER + g.first, g.count, mbusData + g.first)) {
+      if (!g.period_ms) {
+        ok = 0;
+        break;
+      }
+      continue;
     }
-    
-    #ifdef VERBOSE_SERIAL
-      sprint("inverter.read_time: ");
-      sprintln(inverter.read_time);
-      sprint("inverter.read_time_mean: ");
-      sprintln(inverter.read_time_mean);
-    #endif
-  }
 
-  float new_interval = calculateNextInterval();
-  if (new_interval != dynamic_read_interval) {
-    dynamic_read_interval = new_interval;
-    
-    #ifdef VERBOSE_SERIAL
-      sprint("Adjusting read interval to: ");
-      sprint(dynamic_read_interval, 2);
-      sprintln(" s");
-    #endif
+    g.last_read = now;
+    g.updated = uptime();
+    g.reads++;
+    g.refresh = false;
   }
 
-  // Parse register data
-  inverter.op_mode = (float)htons(mbusData[0]);
+  return ok;
+}
 
-  ac.input_voltage = htons(mbusData[1]) / 10.0;
-  ac.input_freq = htons(mbusData[2]) / 10.0;
+void refreshRegisterGroup(uint8_t group) {
+  reg_groups[group].refresh = true;
+}
 
-  dc.pv_voltage = htons(mbusData[3]) / 10.0;
-  if (dc.pv_voltage < 6) {
-    dc.pv_voltage = 0;
-  }
+void decodeStatusFlags(InverterData &inv) {
+  inv.ac_active = (inv.status_4553 & STATUS_4553_AC_ACTIVE) || (inv.status_4554 & STATUS_4554_AC_ACTIVE);
+  inv.on_battery = (inv.status_4553 & STATUS_4553_ON_BATTERY) || (inv.status_4554 & STATUS_4554_ON_BATTERY);
+  inv.load_on = !(inv.status_4553 & STATUS_4553_LOAD_OFF);
+  inv.overload = (inv.status_4516 & STATUS_4516_OVERLOAD) != 0;
+}
+
+// Parse register data into the globals
+static void parseRegisters() {
+  decodeRegisters(mbusData);
 
-  dc.pv_power = (float)htons(mbusData[4]);
+  // Below 6 V the PV input reads noise
   if (dc.pv_voltage < 6) {
+    dc.pv_voltage = 0;
     dc.pv_power = 0;
   }
 
@@ -165,18 +277,10 @@ void sendRequest() {
     dc.pv_current = 0;
   }
 
-  dc.voltage = htons(mbusData[5]) / 10.0;
-
-  dc.charge_current = (float)htons(mbusData[7]);
-  dc.discharge_current = (float)htons(mbusData[8]);
-
   dc.discharge_power = dc.voltage * dc.discharge_current;
   dc.charge_power = dc.voltage * dc.charge_current;
 
-  ac.output_voltage = htons(mbusData[9]) / 10.0;
-  ac.output_freq = htons(mbusData[10]) / 10.0;
-  ac.output_va = (float)htons(mbusData[11]);
-  ac.output_watts = (float)htons(mbusData[12]);
+  decodeStatusFlags(inverter);
 
   if (ac.output_watts > 0 & ac.output_va > 0) {
     ac.power_factor = (ac.output_watts / ac.output_va);
@@ -184,11 +288,6 @@ void sendRequest() {
     ac.power_factor = 1;
   }
 
-  ac.output_load_percent = (float)htons(mbusData[13]);
-
-  inverter.charger = (float)htons(mbusData[54]);
-  inverter.temp = (float)htons(mbusData[56]);
-
   // Battery voltage compensation
   float charge_current_change = -(dc.discharge_current - dc.discharge_current_) 
                                 + (dc.charge_current - dc.charge_current_);
@@ -213,13 +312,15 @@ void sendRequest() {
   dc.discharge_current_ = dc.discharge_current;
   
   inverter.valid_info = 1;
+}
 
-  // Update energy calculations
+// Energy counters and where the output power comes from
+static void updateEnergyFlows() {
   updateBatteryEnergy(dc.voltage_corrected, dc.charge_current, dc.discharge_current);
   updatePVEnergy(dc.pv_voltage, dc.pv_current, dc.pv_power);
 
   // AC output energy spent
-  static unsigned long lastAcMillis = 0;
+  static uint64_t lastAcMillis = 0;
   static bool firstAcCall = true;
   updateEnergy(inverter.energy_spent_ac, ac.output_watts, lastAcMillis, firstAcCall);
 
@@ -282,9 +383,95 @@ void sendRequest() {
   if (inverter.energy_source_batt > 100) inverter.energy_source_batt = 100;
   if (inverter.energy_source_pv < 0) inverter.energy_source_pv = 0;
   if (inverter.energy_source_pv > 100) inverter.energy_source_pv = 100;
+}
+
+// A probe that got no answer leaves the reads at CHUNK_SIZE_MIN, and the
+// next probe waits for one of them to get through: a search against a dead
+// link blocks the task for every timeout it runs into
+static bool probe_failed = false;
+static bool probe_due = false;
+
+// Main function to read inverter data via Modbus
+void sendRequest() {
+  // First contact with this inverter, find how much it answers per read
+  if (!chunk_size || probe_due) {
+    probe_due = false;
+    if (!probeChunkSize()) {
+      chunk_size = CHUNK_SIZE_MIN;
+      chunk_size_max = CHUNK_SIZE_MIN;
+      probe_failed = true;
+      inverter.valid_info = 0;
+      return;
+    }
+    probe_failed = false;
+  }
+
+  LOGD("Reading register groups in chunks of %u", chunk_size);
+  unsigned long start = millis();
+
+  bool ok;
+  {
+    PERF_SCOPE(PERF_MODBUS_READ);
+    ok = readRegisterGroups();
+  }
+  if (!ok) {
+    LOGW("Error reading registers");
+    inverter.valid_info = 0;
+    consecutive_failures++;
+    
+    LOGD("Consecutive failures: %u", consecutive_failures);
+    
+    if (consecutive_failures >= MAX_FAILURES) {
+      readIntervalReset();
+      consecutive_failures = 0;
+
+      LOGW("Max failures reached - reset to %.0fs interval", INITIAL_READ_INTERVAL);
+    }
+    
+    return;
+  }
+
+  consecutive_failures = 0;
+
+  // The link is back: probe for the real size on the next cycle
+  if (probe_failed) {
+    probe_failed = false;
+    probe_due = true;
+  }
+
+  unsigned long stop = millis();
+  if (stop > start) {
+    stop -= start;
+    inverter.read_time = (float)stop / 1000.0;
+
+    if (!read_time_initialized) {
+      read_time_initialized = true;
+      inverter.read_time_mean = inverter.read_time;
+    } else {
+      calculateEWMA(inverter.read_time_mean, inverter.read_time, calculateDynamicAlpha());
+    }
+    
+    LOGD("Read time %.2f s, mean %.2f s", inverter.read_time, inverter.read_time_mean);
+    readIntervalUpdate(inverter.read_time);
+  }
+
+  // Parse register data
+  {
+    PERF_SCOPE(PERF_PARSE);
+    parseRegisters();
+  }
+
+  // Update energy calculations
+  {
+    PERF_SCOPE(PERF_ENERGY);
+    updateEnergyFlows();
+  }
 
   // Calculate battery autonomy
-  calculateAutonomy();
+  {
+    PERF_SCOPE(PERF_AUTONOMY);
+    calculateAutonomy();
+  }
 
   // Save energy data if thresholds exceeded
   saveEnergyData();
@@ -5,7 +5,17 @@
 #define MODBUS_H
 
 #include <Arduino.h>
-#include <ModbusMaster.h>
+#include "data.h"
+#include "modbus_rtu.h"
+
+// Request tags, see ModbusRtu::cancel()
+#define MBUS_TAG_CHUNKS 1
+
+// Index of the settings group in reg_groups
+#define REG_GROUP_SETTINGS 2
+
+// Register groups and their freshness
+extern RegisterGroup reg_groups[REG_GROUPS];
 
 // Initialize Modbus
 void nodeSetup();
@@ -16,7 +26,17 @@ void sendRequest();
 // Internal: read registers in chunks
 uint8_t readRegistersChunked(uint16_t startAddr, uint16_t totalRegs, uint16_t *data);
 
-// Idle callback
-void idle();
+// Internal: read the register groups that are due
+uint8_t readRegisterGroups();
+
+// Read a group on the next cycle, acquisition task only
+void refreshRegisterGroup(uint8_t group);
+
+// Derive ac_active, on_battery, load_on and overload from the status words
+void decodeStatusFlags(InverterData &inv);
+
+// Adaptive chunk size
+void loadChunkSize();
+uint8_t probeChunkSize();
 
 #endif // MODBUS_H
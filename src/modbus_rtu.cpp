@@ -0,0 +1,431 @@
+// Asynchronous Modbus RTU master implementation
+// One request on the wire at a time; everything else waits in the queue.
+// The owner task runs poll() whenever the UART reports received bytes or a
+// deadline passes, so a slow inverter never holds the CPU.
+
+#include "modbus_rtu.h"
+#include "utils.h"
+#include "perf.h"
+#include "log.h"
+
+#define LOG_MODULE LOG_MODBUS
+
+#ifdef NATIVE
+  #define MB_LOCK()
+  #define MB_UNLOCK()
+#else
+  static portMUX_TYPE mbusMux = portMUX_INITIALIZER_UNLOCKED;
+  #define MB_LOCK() portENTER_CRITICAL(&mbusMux)
+  #define MB_UNLOCK() portEXIT_CRITICAL(&mbusMux)
+#endif
+
+// A 16 register read takes about 190 ms on the wire at 2400 baud
+const uint16_t modbus_latency_bounds[MODBUS_LATENCY_BUCKETS - 1] = {25, 50, 100, 200, 400, 800, 1600};
+
+void ModbusRtu::begin(uint8_t slave_id, HardwareSerial &port, unsigned long baud) {
+  slave = slave_id;
+  serial = &port;
+
+  // 3.5 characters of 10 bits, at least 1750 us as the spec asks above 19200
+  interframeUs = max(35000000UL / baud, 1750UL);
+
+  #ifndef NATIVE
+    // Wake the owner when the UART FIFO fills or the line goes quiet
+    serial->setRxTimeout(3);
+    serial->onReceive([this]() { onReceive(); }, false);
+  #endif
+}
+
+void ModbusRtu::attachTask(TaskHandle_t task) {
+  owner = task;
+}
+
+ModbusRequest ModbusRtu::readRequest(uint16_t address, uint16_t qty, uint16_t *data) {
+  ModbusRequest req = {};
+  req.function = 0x03;
+  req.address = address;
+  req.count = qty;
+  req.data = data;
+  req.timeout_ms = MODBUS_TIMEOUT_MS;
+  req.result = MB_PENDING;
+  return req;
+}
+
+ModbusRequest ModbusRtu::writeRequest(uint16_t address, uint16_t value) {
+  ModbusRequest req = {};
+  req.function = 0x06;
+  req.address = address;
+  req.count = value;
+  req.timeout_ms = MODBUS_TIMEOUT_MS;
+  req.result = MB_PENDING;
+  return req;
+}
+
+bool ModbusRtu::submit(const ModbusRequest &req) {
+  if (req.function == 0x03 && (req.count == 0 || req.count > (MODBUS_FRAME_MAX - 5) / 2)) {
+    return false;
+  }
+
+  MB_LOCK();
+  bool queued = count < MODBUS_QUEUE_SIZE;
+  if (queued) {
+    ModbusRequest &slot = queue[(head + count) % MODBUS_QUEUE_SIZE];
+    slot = req;
+    slot.result = MB_PENDING;
+    slot.attempts = 0;
+    slot.cancelled = false;
+    if (slot.future) {
+      slot.future->result = MB_PENDING;
+    }
+    count++;
+  }
+  MB_UNLOCK();
+
+  if (queued && owner) {
+    xTaskNotifyGive(owner);
+  }
+  return queued;
+}
+
+void ModbusRtu::cancel(uint16_t tag) {
+  MB_LOCK();
+  for (uint8_t i = 0; i < count; i++) {
+    ModbusRequest &req = queue[(head + i) % MODBUS_QUEUE_SIZE];
+    // The request on the wire finishes normally
+    if (req.tag == tag && !(i == 0 && state == STATE_WAIT_REPLY)) {
+      req.cancelled = true;
+    }
+  }
+  MB_UNLOCK();
+}
+
+size_t ModbusRtu::pending() {
+  MB_LOCK();
+  size_t n = count;
+  MB_UNLOCK();
+  return n;
+}
+
+bool ModbusRtu::idle() {
+  return state == STATE_IDLE && pending() == 0;
+}
+
+void ModbusRtu::onReceive() {
+  if (owner) {
+    xTaskNotifyGive(owner);
+  }
+}
+
+// Build and send the frame of the request at the head of the queue
+void ModbusRtu::transmit() {
+  ModbusRequest &req = queue[head];
+  uint8_t out[8];
+
+  out[0] = slave;
+  out[1] = req.function;
+  out[2] = req.address >> 8;
+  out[3] = req.address & 0xFF;
+  out[4] = req.count >> 8;
+  out[5] = req.count & 0xFF;
+  uint16_t crc = crc16(out, 6);
+  out[6] = crc & 0xFF;
+  out[7] = crc >> 8;
+
+  // Drop line noise and late replies to an earlier attempt
+  while (serial->available()) {
+    serial->read();
+  }
+
+  if (req.attempts == 0) {
+    firstSentUs = perfNow();
+  }
+  serial->write(out, sizeof(out));
+  sentUs = micros();
+  req.attempts++;
+
+  frameLen = 0;
+  expected = 5;
+  sentAt = millis();
+  state = STATE_WAIT_REPLY;
+}
+
+// Collect reply bytes: header first, then the length it announces
+void ModbusRtu::receive() {
+  ModbusRequest &req = queue[head];
+
+  while (frameLen < expected && serial->available()) {
+    frame[frameLen++] = serial->read();
+
+    if (frameLen == 5) {
+      if (frame[0] != slave) {
+        finishAttempt(MB_INVALID_SLAVE_ID);
+        return;
+      }
+      if ((frame[1] & 0x7F) != req.function) {
+        finishAttempt(MB_INVALID_FUNCTION);
+        return;
+      }
+      if (!(frame[1] & 0x80)) {
+        expected = (req.function == 0x03) ? frame[2] + 5 : 8;
+        if (expected > MODBUS_FRAME_MAX) {
+          finishAttempt(MB_INVALID_FUNCTION);
+          return;
+        }
+      }
+    }
+  }
+
+  if (frameLen < expected) {
+    if (millis() - sentAt >= req.timeout_ms) {
+      finishAttempt(MB_TIMEOUT);
+    }
+    return;
+  }
+
+  uint16_t crc = crc16(frame, frameLen - 2);
+  if (frame[frameLen - 2] != (crc & 0xFF) || frame[frameLen - 1] != (crc >> 8)) {
+    finishAttempt(MB_INVALID_CRC);
+    return;
+  }
+
+  // Exception reply: the slave understood and refused, no point retrying
+  if (frame[1] & 0x80) {
+    recordAttempt(frame[2]);
+    complete(frame[2]);
+    return;
+  }
+
+  if (req.function == 0x03) {
+    if (frame[2] != req.count * 2) {
+      finishAttempt(MB_INVALID_FUNCTION);
+      return;
+    }
+    for (uint16_t i = 0; i < req.count; i++) {
+      req.data[i] = (frame[3 + 2 * i] << 8) | frame[4 + 2 * i];
+    }
+  } else if (((frame[2] << 8) | frame[3]) != req.address || ((frame[4] << 8) | frame[5]) != req.count) {
+    // A write is acknowledged with an echo of the request
+    finishAttempt(MB_INVALID_FUNCTION);
+    return;
+  }
+
+  recordAttempt(MB_SUCCESS);
+  complete(MB_SUCCESS);
+}
+
+// Retry the request at the head of the queue, or give up on it
+void ModbusRtu::finishAttempt(uint8_t result) {
+  ModbusRequest &req = queue[head];
+  recordAttempt(result);
+
+  if (req.attempts <= req.retries && !req.cancelled) {
+    LOGD("Retrying %u at %u after 0x%X, attempt %u", req.function, req.address, result, req.attempts + 1);
+    state = STATE_GAP;
+    gapStart = micros();
+    return;
+  }
+  complete(result);
+}
+
+// Pop the head of the queue and report its result
+void ModbusRtu::complete(uint8_t result) {
+  ModbusRequest req = queue[head];
+
+  MB_LOCK();
+  head = (head + 1) % MODBUS_QUEUE_SIZE;
+  count--;
+  if (req.attempts) {
+    ModbusCounters *chunk = chunkCounters(req);
+    for (ModbusCounters *c : {&linkStats.total, chunk}) {
+      if (c) {
+        c->requests++;
+        c->failures += result != MB_SUCCESS;
+      }
+    }
+  }
+  MB_UNLOCK();
+
+  state = STATE_GAP;
+  gapStart = micros();
+
+  #ifdef PERF_ENABLED
+    // Retries included, cancelled requests never went out
+    if (req.attempts) {
+      perfRecord(PERF_TRANSACTION, perfNow() - firstSentUs);
+    }
+  #endif
+
+  req.result = result;
+  if (req.callback) {
+    req.callback(req);
+  }
+  if (req.future) {
+    req.future->result = result;
+  }
+}
+
+void ModbusRtu::poll() {
+  for (;;) {
+    switch (state) {
+      case STATE_GAP:
+        if (micros() - gapStart < interframeUs) {
+          return;
+        }
+        state = STATE_IDLE;
+        break;
+
+      case STATE_IDLE: {
+        MB_LOCK();
+        bool any = count > 0;
+        bool skip = any && queue[head].cancelled;
+        MB_UNLOCK();
+
+        if (!any) {
+          return;
+        }
+        if (skip) {
+          complete(MB_CANCELLED);
+          state = STATE_IDLE;
+          break;
+        }
+        transmit();
+        return;
+      }
+
+      case STATE_WAIT_REPLY:
+        receive();
+        if (state == STATE_WAIT_REPLY) {
+          return;
+        }
+        break;
+    }
+  }
+}
+
+// Counters of the chunk a request reads or writes, lock held. NULL once
+// the table is full.
+ModbusCounters *ModbusRtu::chunkCounters(const ModbusRequest &req) {
+  uint16_t regs = req.function == 0x03 ? req.count : 1;
+
+  for (uint8_t i = 0; i < linkStats.chunkCount; i++) {
+    ModbusChunkStats &c = linkStats.chunks[i];
+    if (c.function == req.function && c.address == req.address && c.count == regs) {
+      return &c.counters;
+    }
+  }
+  if (linkStats.chunkCount == MODBUS_STATS_CHUNKS) {
+    return NULL;
+  }
+
+  ModbusChunkStats &c = linkStats.chunks[linkStats.chunkCount++];
+  c = {};
+  c.function = req.function;
+  c.address = req.address;
+  c.count = regs;
+  return &c.counters;
+}
+
+// Count the outcome of the attempt that just ended on the request at the
+// head of the queue
+void ModbusRtu::recordAttempt(uint8_t result) {
+  const ModbusRequest &req = queue[head];
+  bool replied = result < MB_INVALID_SLAVE_ID;   // Good or exception reply
+  uint32_t latency = (micros() - sentUs) / 1000;
+
+  uint8_t bucket = 0;
+  while (bucket < MODBUS_LATENCY_BUCKETS - 1 && latency > modbus_latency_bounds[bucket]) {
+    bucket++;
+  }
+
+  MB_LOCK();
+  ModbusCounters *chunk = chunkCounters(req);
+  for (ModbusCounters *c : {&linkStats.total, chunk}) {
+    if (!c) {
+      continue;
+    }
+    c->attempts++;
+    switch (result) {
+      case MB_SUCCESS: c->replies++; break;
+      case MB_TIMEOUT: c->timeouts++; break;
+      case MB_INVALID_CRC: c->crc_errors++; break;
+      case MB_INVALID_SLAVE_ID:
+      case MB_INVALID_FUNCTION: c->invalid++; break;
+      default: c->exceptions++; break;
+    }
+    if (replied) {
+      c->latency_total += latency;
+      c->latency_max = max(c->latency_max, latency);
+    }
+    c->window = (c->window << 1) | (result == MB_SUCCESS);
+    if (c->window_len < 64) {
+      c->window_len++;
+    }
+  }
+  if (replied) {
+    linkStats.latency[bucket]++;
+  }
+  if (!chunk) {
+    linkStats.untracked++;
+  }
+  MB_UNLOCK();
+}
+
+void ModbusRtu::stats(ModbusLinkStats &out) {
+  MB_LOCK();
+  out = linkStats;
+  MB_UNLOCK();
+}
+
+ModbusCounters ModbusRtu::linkCounters() {
+  MB_LOCK();
+  ModbusCounters c = linkStats.total;
+  MB_UNLOCK();
+  return c;
+}
+
+void ModbusRtu::resetStats() {
+  unsigned int now = uptime();
+  MB_LOCK();
+  linkStats = {};
+  linkStats.since = now;
+  MB_UNLOCK();
+}
+
+// Time left before something has to happen without an RX event
+unsigned long ModbusRtu::msUntilDeadline() {
+  switch (state) {
+    case STATE_WAIT_REPLY: {
+      unsigned long elapsed = millis() - sentAt;
+      unsigned long timeout = queue[head].timeout_ms;
+      return elapsed >= timeout ? 0 : timeout - elapsed;
+    }
+    case STATE_GAP:
+      return interframeUs / 1000 + 1;
+    default:
+      return pending() ? 0 : 10;
+  }
+}
+
+void ModbusRtu::wait() {
+  unsigned long ms = msUntilDeadline();
+  if (ms == 0) {
+    return;
+  }
+
+  #ifdef NATIVE
+    // No RX events on the host, check the pty every millisecond
+    delay(1);
+  #else
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+  #endif
+}
+
+uint8_t ModbusRtu::await(ModbusFuture &future) {
+  for (;;) {
+    poll();
+    if (future.done()) {
+      return future.result;
+    }
+    wait();
+  }
+}
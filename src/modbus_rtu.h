@@ -0,0 +1,163 @@
+// Asynchronous Modbus RTU master header
+// Queue of requests driven by UART RX events, replaces the blocking
+// ModbusMaster calls
+
+#ifndef MODBUS_RTU_H
+#define MODBUS_RTU_H
+
+#include <Arduino.h>
+
+#define MODBUS_QUEUE_SIZE 32
+#define MODBUS_FRAME_MAX 256
+#define MODBUS_TIMEOUT_MS 2000   // Per attempt, same as ModbusMaster
+#define MODBUS_STATS_CHUNKS 32   // Chunks with their own counters, the rest only count in the link totals
+#define MODBUS_LATENCY_BUCKETS 8
+
+// Result codes, same values as ModbusMaster's
+#define MB_SUCCESS 0x00
+#define MB_ILLEGAL_FUNCTION 0x01
+#define MB_ILLEGAL_DATA_ADDRESS 0x02
+#define MB_ILLEGAL_DATA_VALUE 0x03
+#define MB_SLAVE_DEVICE_FAILURE 0x04
+#define MB_INVALID_SLAVE_ID 0xE0
+#define MB_INVALID_FUNCTION 0xE1
+#define MB_TIMEOUT 0xE2
+#define MB_INVALID_CRC 0xE3
+#define MB_CANCELLED 0xE4
+#define MB_PENDING 0xFF
+
+struct ModbusRequest;
+typedef void (*ModbusCallback)(const ModbusRequest &req);
+
+// Completion slot a caller can wait on with ModbusRtu::await()
+struct ModbusFuture {
+  volatile uint8_t result = MB_PENDING;
+  bool done() const { return result != MB_PENDING; }
+};
+
+struct ModbusRequest {
+  uint8_t function;          // 0x03 read holding registers, 0x06 write single register
+  uint16_t address;
+  uint16_t count;            // Registers to read, or the value to write
+  uint16_t *data;            // Read destination, filled only on success
+  uint16_t timeout_ms;       // Per attempt
+  uint8_t retries;
+  uint16_t tag;              // Caller defined, see cancel()
+  ModbusCallback callback;   // Called from poll() on completion, may be NULL
+  void *ctx;
+  ModbusFuture *future;      // Completed after the callback, may be NULL
+  uint8_t result;
+  uint8_t attempts;
+  bool cancelled;
+};
+
+// Outcome counters of one chunk, or of the whole link
+struct ModbusCounters {
+  uint32_t requests;      // Requests that went out, completed
+  uint32_t failures;      // Requests that failed after every retry
+  uint32_t attempts;      // Frames sent, retries included
+  uint32_t replies;       // Good replies
+  uint32_t timeouts;
+  uint32_t crc_errors;
+  uint32_t exceptions;    // Exception replies from the slave
+  uint32_t invalid;       // Reply from another slave, function or length
+  uint32_t latency_total; // Milliseconds from transmit to reply, good and exception replies
+  uint32_t latency_max;
+  uint64_t window;        // Last attempts, newest in bit 0, set for a good reply
+  uint8_t window_len;
+
+  // Share of good replies among the last attempts, 1 before the first one
+  float ratio() const {
+    return window_len ? (float)__builtin_popcountll(window) / window_len : 1.0;
+  }
+};
+
+struct ModbusChunkStats {
+  uint8_t function;
+  uint16_t address;
+  uint16_t count;         // Registers, 1 for a write
+  ModbusCounters counters;
+};
+
+// Upper bounds in ms of the latency buckets, the last one is unbounded
+extern const uint16_t modbus_latency_bounds[MODBUS_LATENCY_BUCKETS - 1];
+
+struct ModbusLinkStats {
+  ModbusCounters total;
+  uint32_t latency[MODBUS_LATENCY_BUCKETS];   // Replies per latency bucket
+  ModbusChunkStats chunks[MODBUS_STATS_CHUNKS];
+  uint8_t chunkCount;
+  uint32_t untracked;     // Attempts on chunks past the table
+  unsigned int since;     // uptime() of the last reset
+};
+
+class ModbusRtu {
+public:
+  void begin(uint8_t slave, HardwareSerial &serial, unsigned long baud);
+
+  // Task that owns the state machine, woken up by RX events
+  void attachTask(TaskHandle_t task);
+
+  // Request templates, adjust the fields before submit()
+  static ModbusRequest readRequest(uint16_t address, uint16_t count, uint16_t *data);
+  static ModbusRequest writeRequest(uint16_t address, uint16_t value);
+
+  // Queue a request, safe from any task. False when the queue is full.
+  bool submit(const ModbusRequest &req);
+
+  // Complete queued requests with this tag without sending them
+  void cancel(uint16_t tag);
+
+  // Advance the state machine, owner task only
+  void poll();
+
+  // Sleep until an RX event or the next deadline, owner task only
+  void wait();
+
+  // Poll and wait until the future completes, owner task only
+  uint8_t await(ModbusFuture &future);
+
+  size_t pending();
+  bool idle();
+
+  // Link quality since the last reset, safe from any task
+  void stats(ModbusLinkStats &out);
+  ModbusCounters linkCounters();
+  void resetStats();
+
+  // UART RX event hook
+  void onReceive();
+
+private:
+  enum State : uint8_t { STATE_IDLE, STATE_WAIT_REPLY, STATE_GAP };
+
+  void transmit();
+  void receive();
+  void finishAttempt(uint8_t result);
+  void complete(uint8_t result);
+  unsigned long msUntilDeadline();
+  void recordAttempt(uint8_t result);
+  ModbusCounters *chunkCounters(const ModbusRequest &req);
+
+  HardwareSerial *serial = nullptr;
+  uint8_t slave = 0;
+  TaskHandle_t owner = NULL;
+
+  ModbusRequest queue[MODBUS_QUEUE_SIZE];
+  volatile uint8_t head = 0;
+  volatile uint8_t count = 0;
+
+  State state = STATE_IDLE;
+  uint8_t frame[MODBUS_FRAME_MAX];
+  uint16_t frameLen = 0;
+  uint16_t expected = 0;
+  unsigned long sentAt = 0;       // millis() of the last transmit
+  uint32_t firstSentUs = 0;       // perfNow() of the first attempt
+  unsigned long sentUs = 0;       // micros() of the last transmit
+
+  ModbusLinkStats linkStats = {};
+  unsigned long gapStart = 0;     // micros() of the last completed exchange
+  unsigned long interframeUs = 0; // RTU 3.5 character silence
+};
+
+#endif // MODBUS_RTU_H
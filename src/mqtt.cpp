@@ -0,0 +1,420 @@
+// MQTT publisher implementation
+// Minimal MQTT 3.1.1 client: CONNECT, PUBLISH at QoS 0 or 1, PINGREQ. The
+// publisher task builds PUBLISH packets for each new sample and appends
+// them to a byte ring; when the broker is slow or away the oldest ones are
+// dropped. At QoS 1 the head packet stays queued until its PUBACK and is
+// sent again with DUP after a reconnect.
+
+#include "mqtt.h"
+#include "config.h"
+#include "utils.h"
+#include "snapshot.h"
+#include "status_fields.h"
+#include "json_utils.h"
+#include "events.h"
+#include "credentials.h"
+#include <WiFiClient.h>
+#include "log.h"
+
+#define LOG_MODULE LOG_MQTT
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DUP 0x08
+
+#define MQTT_PACKET_MAX (STATUS_JSON_MAX + 64)
+#define MQTT_VALUE_MAX 16
+
+static WiFiClient net;
+static const char *brokerHost = NULL;
+static uint16_t brokerPort = 0;
+static bool online = false;
+
+// Outbound queue: [length, 2 bytes][PUBLISH packet] entries, oldest at head
+static uint8_t ring[MQTT_QUEUE_BYTES];
+static size_t ringHead = 0;
+static size_t ringUsed = 0;
+
+static uint8_t packet[MQTT_PACKET_MAX];
+static uint16_t nextPacketId = 1;
+static uint16_t awaitedId = 0;            // PUBACK the head packet waits for
+
+static unsigned long lastAttempt = 0;
+static unsigned long lastSent = 0;
+static unsigned long pingSent = 0;        // 0 when no PINGRESP is due
+static uint64_t lastRefresh = 0;
+static uint32_t lastSeq = 0;
+static uint32_t lastEvent = 0;
+
+// Last published text of each field, for change-only publishing
+static char lastValues[STATUS_FIELDS_MAX][MQTT_VALUE_MAX];
+
+static MqttStats stats;
+
+// ==================== QUEUE ====================
+
+static void ringCopyOut(size_t offset, uint8_t *dst, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = ring[(ringHead + offset + i) % MQTT_QUEUE_BYTES];
+  }
+}
+
+static uint16_t headLength() {
+  uint8_t len[2];
+  ringCopyOut(0, len, 2);
+  return (len[0] << 8) | len[1];
+}
+
+static void popHead() {
+  size_t entry = 2 + headLength();
+  ringHead = (ringHead + entry) % MQTT_QUEUE_BYTES;
+  ringUsed -= entry;
+  awaitedId = 0;
+}
+
+static void push(const uint8_t *data, uint16_t len) {
+  size_t entry = 2 + len;
+  if (entry > MQTT_QUEUE_BYTES) {
+    stats.dropped++;
+    return;
+  }
+  while (MQTT_QUEUE_BYTES - ringUsed < entry) {
+    popHead();
+    stats.dropped++;
+  }
+
+  size_t tail = ringHead + ringUsed;
+  ring[tail++ % MQTT_QUEUE_BYTES] = len >> 8;
+  ring[tail++ % MQTT_QUEUE_BYTES] = len & 0xFF;
+  for (uint16_t i = 0; i < len; i++) {
+    ring[tail++ % MQTT_QUEUE_BYTES] = data[i];
+  }
+  ringUsed += entry;
+}
+
+// ==================== PACKETS ====================
+
+// Fixed header with the remaining length, returns its size
+static size_t fixedHeader(uint8_t *buf, uint8_t type, size_t remaining) {
+  size_t n = 0;
+  buf[n++] = type;
+  do {
+    uint8_t b = remaining % 128;
+    remaining /= 128;
+    buf[n++] = remaining ? b | 0x80 : b;
+  } while (remaining);
+  return n;
+}
+
+static size_t putString(uint8_t *buf, const char *s, size_t len) {
+  buf[0] = len >> 8;
+  buf[1] = len & 0xFF;
+  memcpy(buf + 2, s, len);
+  return 2 + len;
+}
+
+// Queue a PUBLISH of payload on MQTT_TOPIC_PREFIX + topic
+static void publish(const char *topic, const char *payload, size_t payloadLen, bool retain = MQTT_RETAIN) {
+  static char fullTopic[64];
+  size_t topicLen = snprintf(fullTopic, sizeof(fullTopic), MQTT_TOPIC_PREFIX "%s", topic);
+  size_t remaining = 2 + topicLen + (MQTT_QOS ? 2 : 0) + payloadLen;
+  if (topicLen >= sizeof(fullTopic) || remaining + 5 > sizeof(packet)) {
+    stats.dropped++;
+    return;
+  }
+
+  size_t n = fixedHeader(packet, MQTT_PUBLISH | (MQTT_QOS << 1) | (retain ? 1 : 0), remaining);
+  n += putString(packet + n, fullTopic, topicLen);
+  if (MQTT_QOS) {
+    packet[n++] = nextPacketId >> 8;
+    packet[n++] = nextPacketId & 0xFF;
+    nextPacketId = nextPacketId == 0xFFFF ? 1 : nextPacketId + 1;
+  }
+  memcpy(packet + n, payload, payloadLen);
+  push(packet, n + payloadLen);
+}
+
+static bool connectBroker() {
+  if (!net.connect(brokerHost, brokerPort, MQTT_CONNECT_TIMEOUT_MS)) {
+    return false;
+  }
+  net.setNoDelay(true);
+
+  const char *clientId = deviceHostname();
+  const char *user = mqttUser();
+  const char *password = mqttPassword();
+  size_t idLen = strlen(clientId);
+  size_t userLen = strlen(user);
+  size_t passLen = strlen(password);
+  static const char willTopic[] = MQTT_TOPIC_PREFIX "online";
+
+  // Clean session, will "0" retained on <prefix>online
+  uint8_t flags = 0x02 | 0x04 | 0x20;
+  size_t remaining = 10 + 2 + idLen + 2 + strlen(willTopic) + 2 + 1;
+  if (userLen) {
+    flags |= 0x80;
+    remaining += 2 + userLen;
+  }
+  if (passLen) {
+    flags |= 0x40;
+    remaining += 2 + passLen;
+  }
+
+  size_t n = fixedHeader(packet, MQTT_CONNECT, remaining);
+  n += putString(packet + n, "MQTT", 4);
+  packet[n++] = 4;   // Protocol level 3.1.1
+  packet[n++] = flags;
+  packet[n++] = MQTT_KEEPALIVE >> 8;
+  packet[n++] = MQTT_KEEPALIVE & 0xFF;
+  n += putString(packet + n, clientId, idLen);
+  n += putString(packet + n, willTopic, strlen(willTopic));
+  n += putString(packet + n, "0", 1);
+  if (userLen) {
+    n += putString(packet + n, user, userLen);
+  }
+  if (passLen) {
+    n += putString(packet + n, password, passLen);
+  }
+  net.write(packet, n);
+
+  // CONNACK: 0x20 0x02 flags return-code
+  uint8_t ack[4];
+  size_t got = 0;
+  unsigned long start = millis();
+  while (got < sizeof(ack) && millis() - start < MQTT_CONNECT_TIMEOUT_MS) {
+    int r = net.available() ? net.read(ack + got, sizeof(ack) - got) : 0;
+    if (r > 0) {
+      got += r;
+    } else {
+      delay(10);
+    }
+  }
+  if (got < sizeof(ack) || ack[0] != MQTT_CONNACK || ack[3] != 0) {
+    LOGW("MQTT connect refused, code %d", got == sizeof(ack) ? ack[3] : -1);
+    net.stop();
+    return false;
+  }
+
+  // Retained birth message, the will replaces it if the link dies
+  n = fixedHeader(packet, MQTT_PUBLISH | 1, 2 + strlen(willTopic) + 1);
+  n += putString(packet + n, willTopic, strlen(willTopic));
+  packet[n++] = '1';
+  net.write(packet, n);
+
+  lastSent = millis();
+  pingSent = 0;
+  awaitedId = 0;
+  return true;
+}
+
+// Read acknowledgements and ping responses
+static void receive() {
+  while (net.available() >= 2) {
+    uint8_t type = net.read();
+    size_t remaining = 0;
+    uint8_t shift = 0;
+    int b;
+    do {
+      b = net.read();
+      if (b < 0) {
+        return;
+      }
+      remaining |= (size_t)(b & 0x7F) << shift;
+      shift += 7;
+    } while (b & 0x80);
+
+    uint8_t body[4] = {0};
+    for (size_t i = 0; i < remaining; i++) {
+      unsigned long start = millis();
+      while (!net.available() && millis() - start < 1000) {
+        delay(1);
+      }
+      int c = net.read();
+      if (i < sizeof(body)) {
+        body[i] = c;
+      }
+    }
+
+    switch (type & 0xF0) {
+      case MQTT_PUBACK:
+        if (awaitedId && ((body[0] << 8) | body[1]) == awaitedId) {
+          popHead();
+          stats.published++;
+        }
+        break;
+      case MQTT_PINGRESP:
+        pingSent = 0;
+        break;
+    }
+  }
+}
+
+// Send the head of the queue, at QoS 1 only once until it is acknowledged
+static bool sendHead() {
+  if (!ringUsed || awaitedId) {
+    return false;
+  }
+
+  uint16_t len = headLength();
+  ringCopyOut(2, packet, len);
+
+  if (MQTT_QOS) {
+    // Packet id follows the topic, after the fixed header
+    size_t n = 1;
+    while (packet[n++] & 0x80) {
+    }
+    size_t topicLen = (packet[n] << 8) | packet[n + 1];
+    size_t id = n + 2 + topicLen;
+    awaitedId = (packet[id] << 8) | packet[id + 1];
+  }
+
+  if (net.write(packet, len) != len) {
+    net.stop();
+    return false;
+  }
+  lastSent = millis();
+
+  if (!MQTT_QOS) {
+    popHead();
+    stats.published++;
+  } else {
+    // A later resend of this packet is a duplicate
+    ring[(ringHead + 2) % MQTT_QUEUE_BYTES] |= MQTT_DUP;
+  }
+  return true;
+}
+
+// ==================== SAMPLES ====================
+
+static void queueSample(const Snapshot &snap) {
+  if (MQTT_BATCH) {
+    static char json[STATUS_JSON_MAX];
+    size_t len = statusJson(snap, json, sizeof(json));
+    if (len) {
+      publish("status", json, len);
+    }
+    return;
+  }
+
+  // Everything again now and then, so retained values and the bridge's
+  // heartbeat never go stale
+  uint64_t now = millis64();
+  bool refresh = now - lastRefresh >= MQTT_REFRESH_INTERVAL * 1000UL;
+  if (refresh) {
+    lastRefresh = now;
+  }
+
+  for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+    const StatusField &f = status_fields[i];
+    char text[MQTT_VALUE_MAX];
+    JsonWriter w(text, sizeof(text) - 1);
+    w.value(snap, f);
+    text[w.length()] = 0;
+
+    if (!refresh && strcmp(text, lastValues[i]) == 0) {
+      continue;
+    }
+    strncpy(lastValues[i], text, MQTT_VALUE_MAX - 1);
+
+    char topic[48];
+    snprintf(topic, sizeof(topic), "%s.%s", status_sections[f.section].key, f.key);
+    publish(topic, text, strlen(text));
+  }
+}
+
+// ==================== TASK ====================
+
+void mqttBegin(const char *host, uint16_t port) {
+  brokerHost = host;
+  brokerPort = port;
+  lastRefresh = millis64();
+}
+
+void mqttLoop() {
+  if (!brokerHost) {
+    return;
+  }
+
+  // Samples are queued even while disconnected, the queue bounds the backlog
+  uint32_t seq = snapshotSeq();
+  if (seq != lastSeq) {
+    lastSeq = seq;
+    Snapshot snap;
+    readSnapshot(snap);
+    if (snap.inverter.valid_info) {
+      queueSample(snap);
+    }
+  }
+
+  // Events are never retained, a new subscriber must not take an old
+  // outage for news
+  Event e;
+  while (eventRead(lastEvent, e)) {
+    lastEvent = e.id;
+    char json[128];
+    JsonWriter w(json, sizeof(json));
+    eventJson(w, e);
+    publish("event", json, w.length(), false);
+  }
+
+  if (!net.connected()) {
+    if (online) {
+      LOGW("MQTT disconnected");
+      online = false;
+    }
+    unsigned long now = millis();
+    if (lastAttempt && now - lastAttempt < MQTT_RECONNECT_INTERVAL * 1000UL) {
+      return;
+    }
+    lastAttempt = now;
+    if (!connectBroker()) {
+      return;
+    }
+    online = true;
+    stats.connects++;
+    LOGI("MQTT connected");
+  }
+
+  receive();
+
+  // Keepalive, and give up on a broker that stopped answering
+  unsigned long now = millis();
+  if (pingSent && now - pingSent > MQTT_KEEPALIVE * 1000UL) {
+    net.stop();
+    return;
+  }
+  if (!pingSent && now - lastSent > MQTT_KEEPALIVE * 1000UL / 2) {
+    uint8_t ping[2] = {MQTT_PINGREQ, 0};
+    net.write(ping, sizeof(ping));
+    pingSent = lastSent = now;
+  }
+
+  while (sendHead()) {
+  }
+}
+
+MqttStats mqttStats() {
+  MqttStats s = stats;
+  s.queued = ringUsed;
+  s.connected = online;
+  return s;
+}
+
+#ifndef NATIVE
+static void mqttTask(void *param) {
+  for (;;) {
+    mqttLoop();
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+void mqttSetup() {
+  mqttBegin(MQTT_HOST, MQTT_PORT);
+  xTaskCreatePinnedToCore(mqttTask, "mqtt", MQTT_TASK_STACK, NULL, MQTT_TASK_PRIORITY, NULL, MQTT_TASK_CORE);
+  LOGI("MQTT publisher started");
+}
+#endif
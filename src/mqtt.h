@@ -0,0 +1,29 @@
+// MQTT publisher header
+// Publishes each new sample to a broker, per field with change-only
+// suppression or as one json payload, through a bounded queue
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <Arduino.h>
+
+struct MqttStats {
+  uint32_t published;   // Messages written to the broker (acknowledged at QoS 1)
+  uint32_t dropped;     // Oldest messages dropped from a full queue
+  uint32_t connects;    // Successful connections
+  size_t queued;        // Bytes waiting in the queue
+  bool connected;
+};
+
+// Set the broker and start the publisher task
+void mqttSetup();
+
+// Broker to connect to, without starting the task (host build)
+void mqttBegin(const char *host, uint16_t port);
+
+// One round: connect, queue a new sample, send, read acks, publisher task only
+void mqttLoop();
+
+MqttStats mqttStats();
+
+#endif // MQTT_H
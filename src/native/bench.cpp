@@ -0,0 +1,348 @@
+// Host-native acquisition benchmark
+// Runs sendRequest() against a serial port (usually the simulator pty from
+// extras/powmr_simulator.py) and reports the wall-clock cost of each cycle
+
+#include <Arduino.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "data.h"
+#include "globals.h"
+#include "utils.h"
+#include "modbus.h"
+#include "snapshot.h"
+#include "mqtt.h"
+#include "influx.h"
+#include "log.h"
+#include "perf.h"
+#include "events.h"
+#include "watchdog.h"
+#include "settings.h"
+#include "scheduler.h"
+#include "read_interval.h"
+#include "utils.h"
+
+// ==================== GLOBAL VARIABLES ====================
+
+// Only the ones the acquisition, parsing and energy modules use
+
+Preferences prefs;
+
+ModbusRtu mbus;
+uint16_t mbusData[MBUS_REGISTERS + 1];
+uint8_t chunk_size = CHUNK_SIZE_MIN;
+uint8_t chunk_size_max = CHUNK_SIZE_MAX;
+
+float dynamic_read_interval = INITIAL_READ_INTERVAL;
+uint8_t consecutive_failures = 0;
+
+bool read_time_initialized = false;
+float autonomy_efficiency_ewma = 0.0;
+float autonomy_watts_ewma = 0.0;
+bool autonomy_initialized = false;
+
+ACData ac;
+DCData dc;
+InverterData inverter;
+
+// ==================== BENCHMARK ====================
+
+// Fixed-rate mode (-r): the cycles run as scheduler jobs, like in the
+// acquisition task
+static Scheduler benchJobs("bench");
+static std::function<void()> cycle;
+static int8_t readJob = -1;
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-p port] [-n cycles] [-i interval_ms] [-m broker[:port]] [-x influx[:port]] [-s key=value] [-r period_ms | -a] [-w] [-v]\n", prog);
+  fprintf(stderr, "  -p  serial device, default /tmp/powmr (simulator link)\n");
+  fprintf(stderr, "  -n  number of sendRequest() cycles, default 10\n");
+  fprintf(stderr, "  -i  pause between cycles in ms, default 0\n");
+  fprintf(stderr, "  -m  publish every sample to this MQTT broker, e.g. a local mosquitto\n");
+  fprintf(stderr, "  -x  write every sample as line protocol to this InfluxDB server\n");
+  fprintf(stderr, "  -s  write an inverter setting before the first cycle, can be repeated\n");
+  fprintf(stderr, "  -r  run the cycles at a fixed rate on the scheduler instead of back to back\n");
+  fprintf(stderr, "  -a  same at the read interval the controller picks, like the acquisition task\n");
+  fprintf(stderr, "  -w  with -r or -a, run the outage watchdog between the cycles\n");
+  fprintf(stderr, "  -v  debug log of every module\n");
+}
+
+int main(int argc, char **argv) {
+  const char *port = "/tmp/powmr";
+  int cycles = 10;
+  int pause_ms = 0;
+  char *broker = NULL;
+  uint16_t broker_port = 1883;
+  char *influx = NULL;
+  uint16_t influx_port = 8086;
+  int rate_ms = 0;
+  bool adaptive = false;
+  bool watchdog = false;
+  std::vector<char *> writes;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:i:m:x:s:r:awvh")) != -1) {
+    switch (opt) {
+      case 'p': port = optarg; break;
+      case 'n': cycles = atoi(optarg); break;
+      case 'i': pause_ms = atoi(optarg); break;
+      case 'm':
+        broker = optarg;
+        if (char *colon = strchr(broker, ':')) {
+          *colon = 0;
+          broker_port = atoi(colon + 1);
+        }
+        break;
+      case 'x':
+        influx = optarg;
+        if (char *colon = strchr(influx, ':')) {
+          *colon = 0;
+          influx_port = atoi(colon + 1);
+        }
+        break;
+      case 's': writes.push_back(optarg); break;
+      case 'r': rate_ms = atoi(optarg); break;
+      case 'a': adaptive = true; break;
+      case 'w': watchdog = true; break;
+      case 'v': logSetLevel("all", "debug"); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if ((watchdog && !rate_ms && !adaptive) || (adaptive && rate_ms)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (adaptive) {
+    rate_ms = dynamic_read_interval * 1000;
+  }
+
+  Serial1.setPort(port);
+  nodeSetup();
+  if (!Serial1) {
+    return 1;
+  }
+
+  if (broker) {
+    mqttBegin(broker, broker_port);
+  }
+  if (influx) {
+    influxBegin(influx, influx_port);
+  }
+
+  // Queued like the web server does, sent by settingsLoop() between cycles
+  for (char *write : writes) {
+    char *eq = strchr(write, '=');
+    uint32_t id = 0;
+    if (!eq) {
+      usage(argv[0]);
+      return 1;
+    }
+    *eq = 0;
+    SettingSubmit result = settingWrite(write, atoi(eq + 1), id);
+    printf("write %s = %s: %s\n", write, eq + 1, result == SUBMIT_OK ? "queued" : "refused");
+  }
+  uint32_t lastWrite = 0;
+  auto printWrites = [&lastWrite]() {
+    SettingWrite job;
+    while (settingWriteStatus(lastWrite + 1, job) && job.state >= WRITE_DONE) {
+      lastWrite = job.id;
+      printf("  write %u: %s = %u %s, read back %u, result 0x%X\n", (unsigned)job.id,
+             inverter_settings[job.setting].key, job.value, settingWriteStateName(job.state), job.readback, job.result);
+    }
+  };
+
+  std::vector<double> times;
+  int failures = 0;
+  uint32_t lastEvent = 0;
+  auto printEvents = [&lastEvent]() {
+    Event e;
+    while (eventRead(lastEvent, e)) {
+      lastEvent = e.id;
+      printf("  event %u: %s, code %u\n", (unsigned)e.id, eventName(e.type), e.code);
+    }
+  };
+
+  int i = 0;
+  cycle = [&]() {
+    uint64_t started = millis64();
+    auto start = std::chrono::steady_clock::now();
+    settingsLoop();
+    sendRequest();
+    eventsUpdate(publishSnapshot());
+    auto stop = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+    if (inverter.valid_info) {
+      times.push_back(ms);
+    } else {
+      failures++;
+    }
+
+    Snapshot snap;
+    readSnapshot(snap);
+    printf("cycle %3d: %9.1f ms  %s  seq=%u ac_in=%.1fV out=%.0fW batt=%.1fV pv=%.0fW",
+           i + 1, ms, snap.inverter.valid_info ? "ok  " : "FAIL", (unsigned)snap.seq,
+           snap.ac.input_voltage, snap.ac.output_watts, snap.dc.voltage, snap.dc.pv_power);
+    if (rate_ms) {
+      printf("  start +%u ms", (unsigned)(started % benchJobs.period(readJob)));
+    }
+    printf("\n");
+    if (adaptive) {
+      benchJobs.setPeriod(readJob, dynamic_read_interval * 1000);
+    }
+
+    printEvents();
+    printWrites();
+
+    if (broker) {
+      mqttLoop();
+    }
+    if (influx) {
+      influxLoop();
+    }
+    i++;
+  };
+
+  if (rate_ms) {
+    readJob = benchJobs.every("read", rate_ms, []() { cycle(); });
+    if (watchdog) {
+      benchJobs.every("watchdog", WATCHDOG_INTERVAL_MS, []() {
+        if (watchdogPoll(benchJobs.dueIn(readJob))) {
+          printf("  watchdog: flags changed\n");
+          benchJobs.after("outage_read", 0, []() { cycle(); });
+        }
+      });
+    }
+    while (i < cycles) {
+      settingsLoop();
+      mbus.poll();
+      delay(min(benchJobs.run(), (uint32_t)10));
+    }
+  } else {
+    while (i < cycles) {
+      cycle();
+      if (pause_ms > 0) {
+        delay(pause_ms);
+      }
+    }
+  }
+
+  // Finish the writes still queued
+  SettingWrite job;
+  while (settingWriteStatus(settingWritesLatest(), job) && job.state < WRITE_DONE) {
+    settingsLoop();
+    mbus.poll();
+    mbus.wait();
+  }
+  printWrites();
+
+  if (broker) {
+    // Drain the queue before reporting
+    unsigned long start = millis();
+    while (mqttStats().queued && millis() - start < 5000) {
+      mqttLoop();
+      delay(1);
+    }
+    MqttStats mq = mqttStats();
+    printf("mqtt: %s, %u published, %u dropped, %u bytes left in queue\n",
+           mq.connected ? "connected" : "not connected", (unsigned)mq.published, (unsigned)mq.dropped, (unsigned)mq.queued);
+  }
+
+  if (influx) {
+    // Send what is left, stop at the first failure
+    uint32_t failures = influxStats().failures;
+    while (influxStats().spooled && influxStats().failures == failures) {
+      influxFlush();
+      influxLoop();
+    }
+    InfluxStats ix = influxStats();
+    printf("influx: %u samples written in %u posts, %u failures, %u dropped, %u spooled, %u -> %u bytes\n",
+           (unsigned)ix.written, (unsigned)ix.posts, (unsigned)ix.failures, (unsigned)ix.dropped,
+           (unsigned)ix.spooled, (unsigned)ix.rawBytes, (unsigned)ix.sentBytes);
+  }
+
+  if (times.empty()) {
+    printf("no successful cycles (%d failures)\n", failures);
+    return 1;
+  }
+
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for (double t : times) {
+    sum += t;
+  }
+  size_t p95 = std::min(times.size() - 1, (size_t)(times.size() * 0.95));
+
+  printf("\nsendRequest(): %zu ok, %d failed\n", times.size(), failures);
+  printf("  min %.1f ms  mean %.1f ms  p50 %.1f ms  p95 %.1f ms  max %.1f ms\n",
+         times.front(), sum / times.size(), times[times.size() / 2], times[p95], times.back());
+
+  ModbusLinkStats link;
+  mbus.stats(link);
+  const ModbusCounters &c = link.total;
+  printf("\nmodbus link: %u requests, %u failed, %u attempts, %u timeouts, %u crc errors, %u exceptions, %u invalid, ratio %.3f\n",
+         (unsigned)c.requests, (unsigned)c.failures, (unsigned)c.attempts, (unsigned)c.timeouts, (unsigned)c.crc_errors,
+         (unsigned)c.exceptions, (unsigned)c.invalid, c.ratio());
+  printf("  latency ms:");
+  for (uint8_t i = 0; i < MODBUS_LATENCY_BUCKETS; i++) {
+    if (i < MODBUS_LATENCY_BUCKETS - 1) {
+      printf(" <=%u:%u", modbus_latency_bounds[i], (unsigned)link.latency[i]);
+    } else {
+      printf(" more:%u\n", (unsigned)link.latency[i]);
+    }
+  }
+  for (uint8_t i = 0; i < link.chunkCount; i++) {
+    const ModbusChunkStats &chunk = link.chunks[i];
+    printf("  %u x%-3u at %u: %u attempts, %u replies, %u timeouts, %u crc, mean %u ms, max %u ms\n",
+           chunk.function, chunk.count, chunk.address, (unsigned)chunk.counters.attempts, (unsigned)chunk.counters.replies,
+           (unsigned)chunk.counters.timeouts, (unsigned)chunk.counters.crc_errors,
+           (unsigned)(chunk.counters.replies + chunk.counters.exceptions
+                      ? chunk.counters.latency_total / (chunk.counters.replies + chunk.counters.exceptions) : 0),
+           (unsigned)chunk.counters.latency_max);
+  }
+
+  if (rate_ms) {
+    JobStats jobs[SCHEDULER_JOBS];
+    uint8_t n = Scheduler::stats(jobs, SCHEDULER_JOBS);
+    for (uint8_t j = 0; j < n; j++) {
+      printf("  job %-8s every %5u ms: %u runs, %u overruns, late max %u ms, run max %u ms\n", jobs[j].name,
+             (unsigned)jobs[j].period_ms, (unsigned)jobs[j].runs, (unsigned)jobs[j].overruns,
+             (unsigned)jobs[j].late_max_ms, (unsigned)jobs[j].run_max_ms);
+    }
+  }
+  if (adaptive) {
+    ReadIntervalStats ri;
+    readIntervalStats(ri);
+    printf("  read interval %.1f s (target %.1f s): p95 %.2f s over %u reads, ratio %.3f, duty %.3f of %.3f, %u changes\n",
+           ri.interval, ri.target, ri.p95, ri.samples, ri.ratio, ri.duty, READ_DUTY_TARGET, (unsigned)ri.changes);
+    for (int8_t d = ri.decisionCount - 1; d >= 0; d--) {
+      const IntervalDecision &dec = ri.decisions[d];
+      printf("    at %u s: %s, %.1f s -> %.1f s, p95 %.2f s, ratio %.3f\n", dec.uptime,
+             intervalReasonName(dec.reason), dec.from, dec.to, dec.p95, dec.ratio);
+    }
+  }
+  if (watchdog) {
+    WatchdogStats wd;
+    watchdogStats(wd);
+    printf("  watchdog: %u polls, %u failed, %u triggers, mean %u ms, max %u ms, bus load %.3f\n",
+           (unsigned)wd.polls, (unsigned)wd.failures, (unsigned)wd.triggers,
+           (unsigned)(wd.polls ? wd.busy_us / wd.polls / 1000 : 0), (unsigned)(wd.max_us / 1000), wd.load());
+  }
+
+  printf("\n%-12s %7s %10s %10s %10s %10s\n", "stage (us)", "count", "mean", "p50", "p95", "max");
+  for (uint8_t i = 0; i < PERF_STAGES; i++) {
+    PerfSummary s;
+    perfSummary((PerfStage)i, s);
+    if (s.count) {
+      printf("%-12s %7u %10u %10u %10u %10u\n", perfStageName(i), (unsigned)s.count,
+             (unsigned)s.mean, (unsigned)s.p50, (unsigned)s.p95, (unsigned)s.max);
+    }
+  }
+
+  return 0;
+}
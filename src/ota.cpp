@@ -4,71 +4,70 @@
 #include "ota.h"
 #include "globals.h"
 #include "energy.h"
-#include "wifi_creds.h"
+#include "snapshot.h"
+#include "sample_log.h"
+#include "credentials.h"
 #include <ESPmDNS.h>
 #include <ArduinoOTA.h>
+#include "log.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
+#define LOG_MODULE LOG_OTA
 
 // Initialize OTA updates
 void otaSetup() {
   ArduinoOTA
       .onStart([]() {
-        // Force save energy data before OTA update
-        saveEnergyData(true);
-        Serial.println("Energy data force saved before OTA update");
+        // Force save energy data before OTA update, from the last published
+        // sample so a Modbus read in progress does not hold the update
+        Snapshot snap;
+        readSnapshot(snap);
+        saveEnergySnapshot(snap);
+        LOGI("Energy data force saved before OTA update");
+        sampleLogFlush();
 
-        String type;
-        if (ArduinoOTA.getCommand() == U_FLASH) {
-          type = "sketch";
-        } else {
-          type = "filesystem";
-        }
-
-        Serial.println("Start updating " + type);
+        LOGI("Start updating %s", ArduinoOTA.getCommand() == U_FLASH ? "sketch" : "filesystem");
       })
       .onEnd([]() {
-        Serial.println("\nEnd");
+        LOGI("End");
       })
       .onProgress([](unsigned int progress, unsigned int total) {
-        Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+        // Every 10%, the queue would drop most of a per-packet log
+        static unsigned int lastStep = 0;
+        unsigned int step = progress / (total / 10);
+        if (step != lastStep) {
+          lastStep = step;
+          LOGI("Progress: %u%%", step * 10);
+        }
       })
       .onError([](ota_error_t error) {
-        Serial.printf("Error[%u]: ", error);
+        const char *reason = "";
         if (error == OTA_AUTH_ERROR) {
-          Serial.println("Auth Failed");
+          reason = "Auth Failed";
         } else if (error == OTA_BEGIN_ERROR) {
-          Serial.println("Begin Failed");
+          reason = "Begin Failed";
         } else if (error == OTA_CONNECT_ERROR) {
-          Serial.println("Connect Failed");
+          reason = "Connect Failed";
         } else if (error == OTA_RECEIVE_ERROR) {
-          Serial.println("Receive Failed");
+          reason = "Receive Failed";
         } else if (error == OTA_END_ERROR) {
-          Serial.println("End Failed");
+          reason = "End Failed";
         }
+        LOGE("Error[%u]: %s", error, reason);
       });
 
   ArduinoOTA.setPort(3232);
-  ArduinoOTA.setHostname(hostname);
+  ArduinoOTA.setHostname(deviceHostname());
 }
 
 // Initialize mDNS
 void mdnsSetup() {
-  if (!MDNS.begin(hostname)) {
-    sprintln(F("Error setting up MDNS responder!"));
+  if (!MDNS.begin(deviceHostname())) {
+    LOGE("Error setting up MDNS responder!");
     while (10) {
       delay(100);
     }
   }
 
-  sprintln("mDNS responder started");
+  LOGI("mDNS responder started");
   MDNS.addService("http", "tcp", 80);
 }
@@ -0,0 +1,108 @@
+// Profiler implementation
+// Log-linear histograms: bucket = octave of the time and its next two
+// bits, so recording is a count-leading-zeros and an increment under a
+// short lock. Percentiles are read back as the upper bound of a bucket.
+
+#include "perf.h"
+#include "utils.h"
+
+#ifdef NATIVE
+  #define PERF_LOCK()
+  #define PERF_UNLOCK()
+#else
+  static portMUX_TYPE perfMux = portMUX_INITIALIZER_UNLOCKED;
+  #define PERF_LOCK() portENTER_CRITICAL(&perfMux)
+  #define PERF_UNLOCK() portEXIT_CRITICAL(&perfMux)
+#endif
+
+struct PerfHistogram {
+  uint32_t buckets[PERF_BUCKETS];
+  uint32_t count;
+  uint32_t max;
+  uint64_t total;
+};
+
+static PerfHistogram histograms[PERF_STAGES];
+static uint32_t since = 0;
+
+static const char *stage_names[PERF_STAGES] = {
+  "cycle", "modbus_read", "transaction", "parse", "energy", "autonomy",
+  "nvs_save", "publish", "history", "status_json", "status_cbor", "watchdog",
+};
+
+static uint8_t bucketOf(uint32_t us) {
+  if (us < PERF_SUB_BUCKETS) {
+    return us;
+  }
+  uint8_t octave = 31 - __builtin_clz(us);
+  uint8_t sub = (us >> (octave - 2)) & (PERF_SUB_BUCKETS - 1);
+  uint16_t bucket = PERF_SUB_BUCKETS * (octave - 1) + sub;
+  return bucket < PERF_BUCKETS ? bucket : PERF_BUCKETS - 1;
+}
+
+// Largest time that lands in a bucket
+static uint32_t bucketLimit(uint8_t bucket) {
+  if (bucket < PERF_SUB_BUCKETS) {
+    return bucket;
+  }
+  uint8_t octave = bucket / PERF_SUB_BUCKETS + 1;
+  uint8_t sub = bucket % PERF_SUB_BUCKETS;
+  return ((uint32_t)(PERF_SUB_BUCKETS + sub + 1) << (octave - 2)) - 1;
+}
+
+void perfRecord(PerfStage stage, uint32_t us) {
+  uint8_t bucket = bucketOf(us);
+  PerfHistogram &h = histograms[stage];
+
+  PERF_LOCK();
+  h.buckets[bucket]++;
+  h.count++;
+  h.total += us;
+  if (us > h.max) {
+    h.max = us;
+  }
+  PERF_UNLOCK();
+}
+
+void perfSummary(PerfStage stage, PerfSummary &out) {
+  const PerfHistogram &h = histograms[stage];
+
+  // Ranks of the percentiles, rounded up: p95 of 10 samples is the 10th
+  const uint8_t pct[3] = {50, 95, 99};
+  uint32_t *dest[3] = {&out.p50, &out.p95, &out.p99};
+  uint8_t next = 0;
+  uint32_t seen = 0;
+
+  for (uint8_t i = 0; i < 3; i++) {
+    *dest[i] = 0;
+  }
+
+  // A hundred buckets at most, short enough to walk with the lock held
+  PERF_LOCK();
+  out.count = h.count;
+  out.mean = h.count ? h.total / h.count : 0;
+  out.max = h.max;
+  for (uint8_t b = 0; b < PERF_BUCKETS && next < 3 && h.count; b++) {
+    seen += h.buckets[b];
+    while (next < 3 && (uint64_t)seen * 100 >= (uint64_t)h.count * pct[next]) {
+      // The bucket bound can overshoot the largest time actually seen
+      *dest[next++] = min(bucketLimit(b), h.max);
+    }
+  }
+  PERF_UNLOCK();
+}
+
+void perfReset() {
+  PERF_LOCK();
+  memset(histograms, 0, sizeof(histograms));
+  PERF_UNLOCK();
+  since = uptime();
+}
+
+uint32_t perfSince() {
+  return since;
+}
+
+const char *perfStageName(uint8_t stage) {
+  return stage < PERF_STAGES ? stage_names[stage] : "?";
+}
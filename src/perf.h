@@ -0,0 +1,89 @@
+// Profiler header
+// Per-stage latency histograms of the hot paths, in fixed memory. Times
+// come from esp_timer (microseconds, 64 bit, same on both cores) rather
+// than the cycle counter, which wraps every 18 s at 240 MHz and is per core.
+//
+// Time a block with a scope:
+//   { PERF_SCOPE(PERF_PARSE); ... }
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <Arduino.h>
+#include "config.h"
+#ifndef NATIVE
+  #include <esp_timer.h>
+#endif
+
+enum PerfStage : uint8_t {
+  PERF_CYCLE,         // Whole acquisition cycle: read, parse, energy, publish
+  PERF_MODBUS_READ,   // readRegisterGroups(), all chunks
+  PERF_TRANSACTION,   // One Modbus request, first transmit to completion
+  PERF_PARSE,         // Registers to globals
+  PERF_ENERGY,        // Battery, PV and AC energy, source percentages
+  PERF_AUTONOMY,      // calculateAutonomy()
+  PERF_NVS_SAVE,      // Preferences writes in saveEnergyData(), only when it writes
+  PERF_PUBLISH,       // publishSnapshot()
+  PERF_HISTORY,       // historyAdd()
+  PERF_STATUS_JSON,   // statusJson()
+  PERF_STATUS_CBOR,   // statusCbor()
+  PERF_WATCHDOG,      // One outage watchdog poll, submit to reply
+  PERF_STAGES,
+};
+
+// Four buckets per power of two, at most 25% wide: 0-3 us exact, then up
+// to 2^(PERF_OCTAVES + 2) us, about 134 s; longer times land in the last one
+#define PERF_SUB_BUCKETS 4
+#define PERF_OCTAVES 25
+#define PERF_BUCKETS (PERF_SUB_BUCKETS * (PERF_OCTAVES + 1))
+
+struct PerfSummary {
+  uint32_t count;
+  uint32_t mean;   // Microseconds, like the rest
+  uint32_t p50;    // Upper bound of the bucket holding the percentile
+  uint32_t p95;
+  uint32_t p99;
+  uint32_t max;    // Exact
+};
+
+inline uint32_t perfNow() {
+  #ifdef NATIVE
+    return micros();
+  #else
+    return (uint32_t)esp_timer_get_time();
+  #endif
+}
+
+// Add one measurement, safe from any task
+void perfRecord(PerfStage stage, uint32_t us);
+
+// Percentiles of a stage since the last reset
+void perfSummary(PerfStage stage, PerfSummary &out);
+
+// Clear every histogram
+void perfReset();
+
+// Uptime in seconds of the last reset, or boot
+uint32_t perfSince();
+
+const char *perfStageName(uint8_t stage);
+
+class PerfScope {
+public:
+  explicit PerfScope(PerfStage s) : stage(s), start(perfNow()) {}
+  ~PerfScope() { perfRecord(stage, perfNow() - start); }
+
+private:
+  PerfStage stage;
+  uint32_t start;
+};
+
+#ifdef PERF_ENABLED
+  #define PERF_CONCAT_(a, b) a##b
+  #define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+  #define PERF_SCOPE(stage) PerfScope PERF_CONCAT(perf_scope_, __LINE__)(stage)
+#else
+  #define PERF_SCOPE(stage) do {} while (0)
+#endif
+
+#endif // PERF_H
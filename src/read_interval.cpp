@@ -0,0 +1,135 @@
+// Read interval controller implementation
+// The p95 rather than the mean: a read that runs into retries takes several
+// times the usual one, and the interval has to leave room for it. Intervals
+// are rounded up to 100 ms, which is plenty for the scheduler grid.
+
+#include "read_interval.h"
+#include "globals.h"
+#include "modbus.h"
+#include "utils.h"
+#include "log.h"
+#include <algorithm>
+
+#define LOG_MODULE LOG_MODBUS
+
+#ifdef NATIVE
+  #define INTERVAL_LOCK()
+  #define INTERVAL_UNLOCK()
+#else
+  static portMUX_TYPE intervalMux = portMUX_INITIALIZER_UNLOCKED;
+  #define INTERVAL_LOCK() portENTER_CRITICAL(&intervalMux)
+  #define INTERVAL_UNLOCK() portEXIT_CRITICAL(&intervalMux)
+#endif
+
+static const char *reason_names[] = {"slower", "faster", "reset"};
+
+// Read times of the window in ms, a ring
+static uint16_t window[READ_TIME_WINDOW];
+static uint8_t windowLen = 0;
+static uint8_t windowNext = 0;
+
+static float target = INITIAL_READ_INTERVAL;
+static float p95 = 0;
+static float mean = 0;
+static float ratio = 1;
+static uint8_t hold = 0;
+static float holdTarget = 0;   // Longest target asked for during the hold
+static uint32_t changes = 0;
+
+static IntervalDecision decisions[READ_INTERVAL_DECISIONS];
+static uint32_t decisionNext = 0;
+
+static void change(float to, IntervalReason reason) {
+  IntervalDecision d = {uptime(), dynamic_read_interval, to, p95, ratio, reason};
+
+  INTERVAL_LOCK();
+  decisions[decisionNext % READ_INTERVAL_DECISIONS] = d;
+  decisionNext++;
+  changes++;
+  dynamic_read_interval = to;
+  INTERVAL_UNLOCK();
+
+  LOGI("Read interval %.1f s -> %.1f s (%s, p95 %.2f s, link ratio %.3f)",
+       d.from, d.to, intervalReasonName(reason), d.p95, d.ratio);
+}
+
+void readIntervalUpdate(float read_time) {
+  window[windowNext] = (uint16_t)min(read_time * 1000, 65535.0f);
+  windowNext = (windowNext + 1) % READ_TIME_WINDOW;
+  if (windowLen < READ_TIME_WINDOW) {
+    windowLen++;
+  }
+
+  // p95 by rank, rounded up: with 20 reads the second longest, so a single
+  // stray read does not double the interval on its own
+  uint16_t sorted[READ_TIME_WINDOW];
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < windowLen; i++) {
+    sorted[i] = window[i];
+    total += window[i];
+  }
+  std::sort(sorted, sorted + windowLen);
+  uint8_t rank = (windowLen * 95 + 99) / 100;
+
+  // A lossy link spends the bus on retries, and failed cycles never make it
+  // into the window: stretch by the share of attempts that got no reply
+  float r = max(mbus.linkCounters().ratio(), (float)LINK_MIN_RATIO);
+  float t = sorted[rank - 1] / 1000.0f / r / READ_DUTY_TARGET;
+  t = ceil(t * 10) / 10;
+  t = constrain(t, (float)READ_INTERVAL_MIN, (float)READ_INTERVAL_MAX);
+
+  INTERVAL_LOCK();
+  p95 = sorted[rank - 1] / 1000.0f;
+  mean = total / 1000.0f / windowLen;
+  ratio = r;
+  target = t;
+  INTERVAL_UNLOCK();
+
+  // Over the target: slow down at once
+  if (t > dynamic_read_interval) {
+    hold = 0;
+    change(t, INTERVAL_SLOWER);
+    return;
+  }
+
+  // Speed up only for a clear gain that lasts
+  if (t <= dynamic_read_interval * (1 - READ_INTERVAL_HYSTERESIS)) {
+    holdTarget = hold ? max(holdTarget, t) : t;
+    if (++hold >= READ_INTERVAL_HOLD) {
+      hold = 0;
+      change(holdTarget, INTERVAL_FASTER);
+    }
+  } else {
+    hold = 0;
+  }
+}
+
+void readIntervalReset() {
+  windowLen = 0;
+  windowNext = 0;
+  hold = 0;
+  if (dynamic_read_interval != INITIAL_READ_INTERVAL) {
+    change(INITIAL_READ_INTERVAL, INTERVAL_RESET);
+  }
+}
+
+void readIntervalStats(ReadIntervalStats &out) {
+  INTERVAL_LOCK();
+  out.interval = dynamic_read_interval;
+  out.target = target;
+  out.p95 = p95;
+  out.ratio = ratio;
+  out.duty = dynamic_read_interval > 0 ? mean / dynamic_read_interval : 0;
+  out.samples = windowLen;
+  out.hold = hold;
+  out.changes = changes;
+  out.decisionCount = min(decisionNext, (uint32_t)READ_INTERVAL_DECISIONS);
+  for (uint8_t i = 0; i < out.decisionCount; i++) {
+    out.decisions[i] = decisions[(decisionNext - 1 - i) % READ_INTERVAL_DECISIONS];
+  }
+  INTERVAL_UNLOCK();
+}
+
+const char *intervalReasonName(uint8_t reason) {
+  return reason < sizeof(reason_names) / sizeof(reason_names[0]) ? reason_names[reason] : "?";
+}
@@ -0,0 +1,54 @@
+// Read interval controller header
+// Sets dynamic_read_interval so the full reads keep the Modbus bus busy
+// READ_DUTY_TARGET of the time: interval = p95 read time / link ratio /
+// target, over the last READ_TIME_WINDOW good reads. It slows down as soon
+// as the target is exceeded, and only speeds up once the new interval has
+// been READ_INTERVAL_HYSTERESIS shorter for READ_INTERVAL_HOLD reads in a row.
+
+#ifndef READ_INTERVAL_H
+#define READ_INTERVAL_H
+
+#include <Arduino.h>
+#include "config.h"
+
+enum IntervalReason : uint8_t {
+  INTERVAL_SLOWER,    // Bus over the duty target
+  INTERVAL_FASTER,    // Room left for more reads
+  INTERVAL_RESET,     // MAX_FAILURES cycles failed in a row
+};
+
+struct IntervalDecision {
+  unsigned int uptime;
+  float from;         // Seconds
+  float to;
+  float p95;          // Read time it was based on, seconds
+  float ratio;        // Link success ratio at the time
+  IntervalReason reason;
+};
+
+struct ReadIntervalStats {
+  float interval;     // Current, seconds
+  float target;       // What the last read asked for, before the hysteresis
+  float p95;          // Over the window, seconds
+  float ratio;
+  float duty;         // Mean read time / interval
+  uint8_t samples;    // Read times in the window
+  uint8_t hold;       // Reads in a row the target has been low enough to speed up
+  uint32_t changes;
+  uint8_t decisionCount;
+  IntervalDecision decisions[READ_INTERVAL_DECISIONS];   // Newest first
+};
+
+// A good read took read_time seconds: update dynamic_read_interval.
+// Acquisition task only.
+void readIntervalUpdate(float read_time);
+
+// Back to INITIAL_READ_INTERVAL with an empty window, after MAX_FAILURES
+void readIntervalReset();
+
+// Copy of the state and the last decisions, safe from any task
+void readIntervalStats(ReadIntervalStats &out);
+
+const char *intervalReasonName(uint8_t reason);
+
+#endif // READ_INTERVAL_H
@@ -0,0 +1,410 @@
+// Sample log implementation
+// Records are 32 bytes with a CRC, batched in RAM and appended a SPIFFS page
+// at a time. Segments are named after their first sequence number and
+// hold consecutive records; every boot starts a new one, so a record torn
+// by a power cut can only be at the end of a segment, where readers stop.
+// The oldest segments go first when the log outgrows its budget.
+
+#include "sample_log.h"
+#include "config.h"
+#include "utils.h"
+#include "status_fields.h"
+#include "json_utils.h"
+#include <SPIFFS.h>
+#include <Preferences.h>
+#include "log.h"
+
+#define LOG_MODULE LOG_SAMPLES
+
+static const char *const log_keys[] = {SAMPLE_LOG_FIELDS};
+#define LOG_COUNT (sizeof(log_keys) / sizeof(log_keys[0]))
+
+static_assert(LOG_COUNT <= SAMPLE_LOG_SLOTS, "too many SAMPLE_LOG_FIELDS");
+static_assert(sizeof(SampleRecord) == 32, "sample records are 32 bytes on flash");
+
+#define SEGMENT_PREFIX "/log_"
+#define RECORD_EMPTY INT16_MIN
+
+enum : uint8_t { STAGE_HEADER, STAGE_RECORDS, STAGE_DONE };
+
+struct Segment {
+  uint32_t first;   // seq of its first record
+  uint32_t size;    // Bytes written
+};
+
+static Segment segments[SAMPLE_LOG_MAX_SEGMENTS];   // Oldest first
+static uint8_t segmentCount = 0;
+static File current;                                // Newest segment, appended to
+static uint32_t nextSeq = 1;
+static uint16_t boot = 0;
+
+static SampleRecord batch[SAMPLE_LOG_BATCH];
+static uint8_t batchCount = 0;
+static uint32_t lastSnapshot = 0;
+
+static const StatusField *fields[LOG_COUNT];
+static float scales[LOG_COUNT];
+static bool enabled = false;
+
+// Guards segments and batch, shared with the export in the AsyncTCP task
+static SemaphoreHandle_t logLock = NULL;
+
+static void segmentPath(char *path, size_t size, uint32_t first) {
+  snprintf(path, size, SEGMENT_PREFIX "%08x.bin", (unsigned)first);
+}
+
+static bool validRecord(const SampleRecord &r) {
+  return crc16((const uint8_t *)&r, offsetof(SampleRecord, crc)) == r.crc;
+}
+
+// seq after the last valid record of a segment, 0 if it has none
+static uint32_t segmentEnd(uint32_t first) {
+  char path[24];
+  segmentPath(path, sizeof(path), first);
+  File f = SPIFFS.open(path, FILE_READ);
+
+  uint32_t end = 0;
+  SampleRecord r;
+  while (f && f.read((uint8_t *)&r, sizeof(r)) == sizeof(r) && validRecord(r)) {
+    end = r.seq + 1;
+  }
+  return end;
+}
+
+static void removeOldest() {
+  char path[24];
+
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  segmentPath(path, sizeof(path), segments[0].first);
+  memmove(segments, segments + 1, --segmentCount * sizeof(Segment));
+  xSemaphoreGive(logLock);
+
+  SPIFFS.remove(path);
+}
+
+// Close the newest segment and open a new one, making room first
+static bool startSegment(uint32_t first) {
+  if (current) {
+    current.close();
+  }
+
+  for (;;) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < segmentCount; i++) {
+      total += segments[i].size;
+    }
+    bool full = total + SAMPLE_LOG_SEGMENT_SIZE > SAMPLE_LOG_MAX_SIZE || segmentCount == SAMPLE_LOG_MAX_SEGMENTS
+             || SPIFFS.totalBytes() - SPIFFS.usedBytes() < 2 * SAMPLE_LOG_SEGMENT_SIZE;
+    if (!full || segmentCount == 0) {
+      break;
+    }
+    removeOldest();
+  }
+
+  char path[24];
+  segmentPath(path, sizeof(path), first);
+  current = SPIFFS.open(path, FILE_APPEND);
+  if (!current) {
+    LOGE("Cannot create %s", path);
+    return false;
+  }
+
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  segments[segmentCount++] = {first, 0};
+  xSemaphoreGive(logLock);
+  return true;
+}
+
+void sampleLogSetup() {
+  logLock = xSemaphoreCreateMutex();
+
+  for (uint8_t f = 0; f < LOG_COUNT; f++) {
+    fields[f] = findField(log_keys[f]);
+    if (!fields[f]) {
+      LOGE("Unknown sample log field %s", log_keys[f]);
+      continue;
+    }
+    scales[f] = powf(10, fields[f]->precision);
+  }
+
+  Preferences bootPrefs;
+  bootPrefs.begin("sample_log", false);
+  boot = bootPrefs.getUShort("boot", 0) + 1;
+  bootPrefs.putUShort("boot", boot);
+  bootPrefs.end();
+
+  File root = SPIFFS.open("/");
+  if (!root) {
+    LOGE("Sample log disabled, no filesystem");
+    return;
+  }
+
+  // Keep the newest segments sorted, older extras are deleted after the scan
+  uint32_t evicted[8];
+  uint8_t evictedCount = 0;
+  for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+    const char *path = f.path();
+    if (strncmp(path, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) != 0) {
+      continue;
+    }
+    Segment seg = {(uint32_t)strtoul(path + strlen(SEGMENT_PREFIX), NULL, 16), (uint32_t)f.size()};
+
+    if (segmentCount == SAMPLE_LOG_MAX_SEGMENTS) {
+      uint32_t oldest = min(seg.first, segments[0].first);
+      if (evictedCount < 8) {
+        evicted[evictedCount++] = oldest;
+      }
+      if (oldest == seg.first) {
+        continue;
+      }
+      memmove(segments, segments + 1, --segmentCount * sizeof(Segment));
+    }
+
+    uint8_t i = segmentCount++;
+    for (; i > 0 && segments[i - 1].first > seg.first; i--) {
+      segments[i] = segments[i - 1];
+    }
+    segments[i] = seg;
+  }
+  root.close();
+
+  for (uint8_t i = 0; i < evictedCount; i++) {
+    char path[24];
+    segmentPath(path, sizeof(path), evicted[i]);
+    SPIFFS.remove(path);
+  }
+
+  // Carry on after the last good record, a segment without any is garbage
+  while (segmentCount) {
+    uint32_t end = segmentEnd(segments[segmentCount - 1].first);
+    if (end) {
+      nextSeq = end;
+      break;
+    }
+    char path[24];
+    segmentPath(path, sizeof(path), segments[segmentCount - 1].first);
+    SPIFFS.remove(path);
+    segmentCount--;
+  }
+
+  enabled = true;
+
+  LOGI("Sample log: %u segments, next record %lu, boot %u", (unsigned)segmentCount,
+       (unsigned long)nextSeq, (unsigned)boot);
+}
+
+void sampleLogLoop() {
+  if (!enabled) {
+    return;
+  }
+
+  uint32_t seq = snapshotSeq();
+  if (seq != lastSnapshot) {
+    lastSnapshot = seq;
+
+    Snapshot snap;
+    readSnapshot(snap);
+    if (snap.inverter.valid_info && batchCount < SAMPLE_LOG_BATCH) {
+      SampleRecord r = {};
+      r.seq = nextSeq++;
+      r.uptime = snap.uptime;
+      r.boot = boot;
+      for (uint8_t f = 0; f < SAMPLE_LOG_SLOTS; f++) {
+        float v = f < LOG_COUNT && fields[f] ? fieldValue(snap, *fields[f]) : NAN;
+        r.values[f] = isnan(v) ? RECORD_EMPTY : (int16_t)constrain(lroundf(v * scales[f]), -INT16_MAX, (long)INT16_MAX);
+      }
+      r.crc = crc16((const uint8_t *)&r, offsetof(SampleRecord, crc));
+
+      xSemaphoreTake(logLock, portMAX_DELAY);
+      batch[batchCount++] = r;
+      xSemaphoreGive(logLock);
+    }
+  }
+
+  // A partial batch is written by the loop's sample_log job
+  if (batchCount == SAMPLE_LOG_BATCH) {
+    sampleLogFlush();
+  }
+}
+
+void sampleLogFlush() {
+  if (!enabled || batchCount == 0) {
+    return;
+  }
+
+  size_t bytes = batchCount * sizeof(SampleRecord);
+  if (!current || segments[segmentCount - 1].size + bytes > SAMPLE_LOG_SEGMENT_SIZE) {
+    if (!startSegment(batch[0].seq)) {
+      LOGE("Sample log disabled");
+      enabled = false;
+      return;
+    }
+  }
+
+  size_t written = current.write((const uint8_t *)batch, bytes);
+  current.flush();
+
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  segments[segmentCount - 1].size += written;
+  batchCount = 0;
+  xSemaphoreGive(logLock);
+
+  if (written != bytes) {
+    // Filesystem full or failing; a partial record ends this segment
+    LOGE("Sample log write failed");
+    current.close();
+  }
+}
+
+void sampleLogQuery(SampleLogQuery &q, uint32_t since) {
+  q.cursor = since + 1;
+  q.segment = 0;
+  q.file = File();
+  q.stage = STAGE_HEADER;
+  q.first = true;
+  q.itemLen = 0;
+  q.itemSent = 0;
+  q.headerSent = 0;
+}
+
+// Open the segment holding q.cursor, or the oldest one
+static bool openSegment(SampleLogQuery &q) {
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  int i = segmentCount - 1;
+  while (i > 0 && segments[i].first > q.cursor) {
+    i--;
+  }
+  Segment seg = i >= 0 ? segments[i] : Segment{0, 0};
+  xSemaphoreGive(logLock);
+
+  if (i < 0) {
+    return false;
+  }
+
+  q.cursor = max(q.cursor, seg.first);
+  q.segment = seg.first;
+
+  char path[24];
+  segmentPath(path, sizeof(path), seg.first);
+  q.file = SPIFFS.open(path, FILE_READ);
+  if (!q.file) {
+    return false;
+  }
+  // Past the end the read below fails and the next segment is tried
+  q.file.seek((q.cursor - seg.first) * sizeof(SampleRecord));
+  return true;
+}
+
+// Next record at or after q.cursor, from flash and then from the batch
+static bool readNext(SampleLogQuery &q, SampleRecord &r) {
+  for (uint8_t tries = 0; tries <= SAMPLE_LOG_MAX_SEGMENTS; tries++) {
+    if (!q.file && !openSegment(q)) {
+      break;
+    }
+
+    if (q.file.read((uint8_t *)&r, sizeof(r)) == sizeof(r) && validRecord(r) && r.seq >= q.cursor) {
+      q.cursor = r.seq + 1;
+      return true;
+    }
+    q.file.close();
+
+    // End of this segment, carry on with the next one if there is one
+    bool more = false;
+    xSemaphoreTake(logLock, portMAX_DELAY);
+    for (uint8_t i = 0; i < segmentCount && !more; i++) {
+      if (segments[i].first > q.segment) {
+        q.cursor = max(q.cursor, segments[i].first);
+        more = true;
+      }
+    }
+    xSemaphoreGive(logLock);
+    if (!more) {
+      break;
+    }
+  }
+
+  bool found = false;
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  if (batchCount && q.cursor >= batch[0].seq && q.cursor < batch[0].seq + batchCount) {
+    r = batch[q.cursor - batch[0].seq];
+    q.cursor++;
+    found = true;
+  }
+  xSemaphoreGive(logLock);
+  return found;
+}
+
+static void header(JsonWriter &w) {
+  w.raw('{');
+  w.key("boot");
+  w.u32(boot);
+  w.raw(',');
+  w.key("now");
+  w.u32(uptime());
+  w.raw(',');
+  w.key("fields");
+  w.raw('[');
+  for (uint8_t f = 0; f < LOG_COUNT; f++) {
+    if (f) {
+      w.raw(',');
+    }
+    w.str(log_keys[f]);
+  }
+  w.raw("],");
+  w.key("records");
+  w.raw('[');
+}
+
+// Render the next record, or the footer after the last one
+static void nextItem(SampleLogQuery &q) {
+  JsonWriter w(q.item, sizeof(q.item));
+  SampleRecord r;
+
+  if (readNext(q, r)) {
+    w.raw(q.first ? "[" : ",[");
+    w.u32(r.seq);
+    w.raw(',');
+    w.u32(r.boot);
+    w.raw(',');
+    w.u32(r.uptime);
+    for (uint8_t f = 0; f < LOG_COUNT; f++) {
+      w.raw(',');
+      uint8_t precision = fields[f] ? fields[f]->precision : 0;
+      w.fixed(r.values[f] == RECORD_EMPTY ? NAN : r.values[f] / scales[f], precision);
+    }
+    w.raw(']');
+    q.first = false;
+  } else {
+    w.raw("]}");
+    q.stage = STAGE_DONE;
+  }
+
+  q.itemLen = w.length();
+  q.itemSent = 0;
+}
+
+size_t sampleLogRead(SampleLogQuery &q, char *buf, size_t size) {
+  if (q.stage == STAGE_HEADER) {
+    JsonWriter w(buf, size, q.headerSent);
+    header(w);
+    q.headerSent += w.length();
+    if (!w.full()) {
+      q.stage = STAGE_RECORDS;
+    }
+    return w.length();
+  }
+
+  // Records are rendered once and may span chunks, the window can be small
+  size_t len = 0;
+  for (;;) {
+    size_t n = min((size_t)(q.itemLen - q.itemSent), size - len);
+    memcpy(buf + len, q.item + q.itemSent, n);
+    len += n;
+    q.itemSent += n;
+
+    if (q.itemSent < q.itemLen || q.stage == STAGE_DONE) {
+      return len;
+    }
+    nextItem(q);
+  }
+}
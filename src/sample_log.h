@@ -0,0 +1,51 @@
+// Sample log header
+// Append-only log of compact samples on SPIFFS, in rotating segments, so a
+// collector can catch up after WiFi or the bridge was down
+
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "snapshot.h"
+
+#define SAMPLE_LOG_SLOTS 10
+
+// One sample, values scaled by 10^precision of their field
+struct SampleRecord {
+  uint32_t seq;                       // Log sequence number, kept across reboots
+  uint32_t uptime;                    // uptime() of the sample
+  uint16_t boot;                      // Boot counter
+  int16_t values[SAMPLE_LOG_SLOTS];   // SAMPLE_LOG_FIELDS, then unused slots
+  uint16_t crc;                       // crc16() of the bytes before it
+};
+
+// State of one /api/log response, advanced chunk by chunk
+struct SampleLogQuery {
+  uint32_t cursor;    // Next record to send
+  uint32_t segment;   // First seq of the open segment
+  File file;
+  uint8_t stage;      // Header, records, done
+  bool first;         // No record written yet
+  uint16_t headerSent;
+  char item[160];     // Rendered record not fully sent yet
+  uint8_t itemLen;
+  uint8_t itemSent;
+};
+
+// Find the segments and the next sequence number, SPIFFS must be mounted
+void sampleLogSetup();
+
+// Queue new samples and write the batch when full, called from loop()
+void sampleLogLoop();
+
+// Write the queued records now, every SAMPLE_LOG_FLUSH_INTERVAL from loop()
+void sampleLogFlush();
+
+// Start an export of the records after seq since
+void sampleLogQuery(SampleLogQuery &q, uint32_t since);
+
+// Write the next part of the export, 0 when it is complete
+size_t sampleLogRead(SampleLogQuery &q, char *buf, size_t size);
+
+#endif // SAMPLE_LOG_H
@@ -0,0 +1,157 @@
+// Cooperative scheduler implementation
+// A job slot is free when fn is NULL. The owner task alone adds, runs and
+// drops jobs; the lock only keeps the counters consistent for stats().
+
+#include "scheduler.h"
+#include "utils.h"
+
+#ifdef NATIVE
+  #define SCHED_LOCK()
+  #define SCHED_UNLOCK()
+#else
+  static portMUX_TYPE schedMux = portMUX_INITIALIZER_UNLOCKED;
+  #define SCHED_LOCK() portENTER_CRITICAL(&schedMux)
+  #define SCHED_UNLOCK() portEXIT_CRITICAL(&schedMux)
+#endif
+
+static Scheduler *schedulers[SCHEDULERS_MAX];
+static uint8_t schedulerCount = 0;
+
+Scheduler::Scheduler(const char *name) : name(name) {
+  if (schedulerCount < SCHEDULERS_MAX) {
+    schedulers[schedulerCount++] = this;
+  }
+}
+
+int8_t Scheduler::add(const char *jobName, uint32_t period_ms, uint64_t due, JobFunction fn) {
+  for (int8_t i = 0; i < SCHEDULER_JOBS; i++) {
+    Job &j = jobs[i];
+    if (j.fn) {
+      continue;
+    }
+    SCHED_LOCK();
+    j = {};
+    j.name = jobName;
+    j.period_ms = period_ms;
+    j.due = due;
+    j.fn = fn;
+    SCHED_UNLOCK();
+    return i;
+  }
+  return -1;
+}
+
+int8_t Scheduler::every(const char *jobName, uint32_t period_ms, JobFunction fn) {
+  if (!period_ms) {
+    return -1;
+  }
+  return add(jobName, period_ms, (millis64() / period_ms + 1) * period_ms, fn);
+}
+
+int8_t Scheduler::after(const char *jobName, uint32_t delay_ms, JobFunction fn) {
+  return add(jobName, 0, millis64() + delay_ms, fn);
+}
+
+void Scheduler::setPeriod(int8_t job, uint32_t period_ms) {
+  Job &j = jobs[job];
+  if (!period_ms || period_ms == j.period_ms) {
+    return;
+  }
+  SCHED_LOCK();
+  j.period_ms = period_ms;
+  j.due = (millis64() / period_ms + 1) * period_ms;
+  SCHED_UNLOCK();
+}
+
+uint32_t Scheduler::period(int8_t job) {
+  return jobs[job].period_ms;
+}
+
+uint32_t Scheduler::dueIn(int8_t job) {
+  uint64_t now = millis64();
+  return jobs[job].due > now ? jobs[job].due - now : 0;
+}
+
+uint32_t Scheduler::run() {
+  uint64_t next = UINT64_MAX;
+
+  for (uint8_t i = 0; i < SCHEDULER_JOBS; i++) {
+    Job &j = jobs[i];
+    if (!j.fn) {
+      continue;
+    }
+
+    uint64_t start = millis64();
+    if (start < j.due) {
+      next = min(next, j.due);
+      continue;
+    }
+
+    uint64_t due = j.due;
+    uint32_t period_ms = j.period_ms;
+    j.fn();
+    uint64_t end = millis64();
+
+    SCHED_LOCK();
+    j.runs++;
+    j.late_max_ms = max(j.late_max_ms, (uint32_t)(start - due));
+    j.run_max_ms = max(j.run_max_ms, (uint32_t)(end - start));
+    if (!period_ms) {
+      j.fn = nullptr;
+    } else if (j.due == due) {
+      // Next multiple of the period still ahead, the ones passed are lost
+      uint64_t missed = (end - due) / period_ms;
+      j.overruns += missed;
+      j.due = due + (missed + 1) * period_ms;
+    }
+    // else the job changed its own period while it ran, setPeriod() placed it
+    SCHED_UNLOCK();
+
+    if (j.fn) {
+      next = min(next, j.due);
+    }
+  }
+
+  uint64_t now = millis64();
+  return next == UINT64_MAX ? UINT32_MAX : next > now ? min(next - now, (uint64_t)UINT32_MAX) : 0;
+}
+
+uint8_t Scheduler::stats(JobStats *out, uint8_t max) {
+  uint64_t now = millis64();
+  uint8_t n = 0;
+
+  SCHED_LOCK();
+  for (uint8_t s = 0; s < schedulerCount; s++) {
+    const Scheduler &sched = *schedulers[s];
+    for (uint8_t i = 0; i < SCHEDULER_JOBS && n < max; i++) {
+      const Job &j = sched.jobs[i];
+      if (!j.fn) {
+        continue;
+      }
+      JobStats &o = out[n++];
+      o.scheduler = sched.name;
+      o.name = j.name;
+      o.period_ms = j.period_ms;
+      o.runs = j.runs;
+      o.overruns = j.overruns;
+      o.late_max_ms = j.late_max_ms;
+      o.run_max_ms = j.run_max_ms;
+      o.due_in_ms = j.due > now ? j.due - now : 0;
+    }
+  }
+  SCHED_UNLOCK();
+  return n;
+}
+
+void Scheduler::resetStats() {
+  SCHED_LOCK();
+  for (uint8_t s = 0; s < schedulerCount; s++) {
+    for (Job &j : schedulers[s]->jobs) {
+      j.runs = 0;
+      j.overruns = 0;
+      j.late_max_ms = 0;
+      j.run_max_ms = 0;
+    }
+  }
+  SCHED_UNLOCK();
+}
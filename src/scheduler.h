@@ -0,0 +1,78 @@
+// Cooperative scheduler header
+// The timed jobs of one task, run from its loop by run(). Periodic jobs are
+// fixed rate: a run is due one period after the previous due time, not after
+// the previous run ended, so runs land on multiples of the period since boot
+// and never drift. Periods a late run overshoots are skipped and counted as
+// overruns. Times come from millis64(), which never wraps.
+//
+//   static Scheduler jobs("loop");
+//   jobs.every("wifi", 180000, checkWifi);
+//   for (;;) { delay(min(jobs.run(), 10U)); }
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#define SCHEDULER_JOBS 6       // Per scheduler, one-shots included
+#define SCHEDULERS_MAX 4
+
+typedef void (*JobFunction)();
+
+struct JobStats {
+  const char *scheduler;
+  const char *name;
+  uint32_t period_ms;      // 0 for a one-shot
+  uint32_t runs;
+  uint32_t overruns;       // Periods skipped because a run started or ended too late
+  uint32_t late_max_ms;    // Largest delay between due time and start
+  uint32_t run_max_ms;     // Longest run
+  uint32_t due_in_ms;      // Until the next run, 0 when due
+};
+
+class Scheduler {
+public:
+  explicit Scheduler(const char *name);
+
+  // Periodic job, first run on the next multiple of period_ms. -1 when the
+  // table is full.
+  int8_t every(const char *name, uint32_t period_ms, JobFunction fn);
+
+  // One-shot job, run once delay_ms from now and then dropped
+  int8_t after(const char *name, uint32_t delay_ms, JobFunction fn);
+
+  // New period, the next run moves to the next multiple of it
+  void setPeriod(int8_t job, uint32_t period_ms);
+
+  uint32_t period(int8_t job);
+
+  // Milliseconds until the job is due, 0 when due
+  uint32_t dueIn(int8_t job);
+
+  // Run the jobs that are due, owner task only. Milliseconds until the next
+  // one is due.
+  uint32_t run();
+
+  // Counters of every job of every scheduler, safe from any task
+  static uint8_t stats(JobStats *out, uint8_t max);
+  static void resetStats();
+
+private:
+  struct Job {
+    const char *name;
+    JobFunction fn;
+    uint32_t period_ms;
+    uint64_t due;
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t late_max_ms;
+    uint32_t run_max_ms;
+  };
+
+  const char *name;
+  Job jobs[SCHEDULER_JOBS] = {};
+
+  int8_t add(const char *name, uint32_t period_ms, uint64_t due, JobFunction fn);
+};
+
+#endif // SCHEDULER_H
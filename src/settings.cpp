@@ -0,0 +1,243 @@
+// Inverter settings implementation
+// One write in flight at a time: the read back is queued from the write's
+// completion callback, so a write costs the bus two short transactions and
+// never waits on the read cycle or holds it up.
+
+#include "settings.h"
+#include "config.h"
+#include "globals.h"
+#include "modbus.h"
+#include "utils.h"
+#include "log.h"
+
+#define LOG_MODULE LOG_SETTINGS
+
+#ifdef NATIVE
+  #define SET_LOCK()
+  #define SET_UNLOCK()
+#else
+  static portMUX_TYPE settingsMux = portMUX_INITIALIZER_UNLOCKED;
+  #define SET_LOCK() portENTER_CRITICAL(&settingsMux)
+  #define SET_UNLOCK() portEXIT_CRITICAL(&settingsMux)
+#endif
+
+#define ON_OFF(key, address, mask, name) {key, address, 4535, mask, 0, 1, {}, name}
+
+// Output voltage (5023) and frequency (5021) are left out: the documented
+// values are those of the 230 V models. Battery type (5020) and the charge
+// voltages (5025-5033) have no register to read them back or no range.
+constexpr InverterSetting inverter_settings[] = {
+  ON_OFF("buzzer", 5002, 0x0100, "Buzzer Alarm"),
+  ON_OFF("backlight", 5004, 0x0400, "Backlight"),
+  ON_OFF("restart_on_overload", 5005, 0x0800, "Auto Restart On Overload"),
+  ON_OFF("restart_on_overheat", 5006, 0x1000, "Auto Restart On Over Temperature"),
+  ON_OFF("beep_on_source_fail", 5007, 0x2000, "Beep On Primary Source Fail"),
+  ON_OFF("return_to_default_screen", 5008, 0x4000, "Return To Default Screen"),
+  ON_OFF("overload_bypass", 5009, 0x8000, "Overload Bypass"),
+  ON_OFF("record_fault_code", 5010, 0x0001, "Record Fault Code"),
+  {"charger_source_priority", 5017, 4536, 0, 0, 3, {}, "Charger Source Priority"},
+  {"output_source_priority", 5018, 4537, 0, 0, 2, {}, "Output Source Priority"},
+  {"ac_input_range", 5019, 4538, 0, 0, 1, {}, "AC Input Voltage Range"},
+  {"max_charge_current", 5022, 4541, 0, 10, 80, {}, "Max Total Charge Current"},
+  {"utility_charge_current", 5024, 4543, 0, 2, 60, {2, 10, 20, 30, 40, 50, 60}, "Utility Charge Current"},
+};
+
+const uint8_t INVERTER_SETTINGS = sizeof(inverter_settings) / sizeof(inverter_settings[0]);
+
+// Write registers in the documented block, read back within what the
+// register groups read
+constexpr bool settingsValid(uint8_t i = 0) {
+  return i == sizeof(inverter_settings) / sizeof(inverter_settings[0]) ||
+         (inverter_settings[i].address >= 5002 && inverter_settings[i].address <= 5033 &&
+          inverter_settings[i].readback >= MBUS_FIRST_REGISTER &&
+          inverter_settings[i].readback < MBUS_FIRST_REGISTER + MBUS_REGISTERS &&
+          inverter_settings[i].min <= inverter_settings[i].max &&
+          settingsValid(i + 1));
+}
+static_assert(settingsValid(), "setting outside 5002-5033, read back outside 4501-4561, or empty range");
+
+static const char *state_names[] = {
+  "queued", "sending", "verifying", "done", "mismatch", "failed",
+};
+
+static SettingWrite jobs[SETTING_WRITE_JOBS];
+static uint32_t latest = 0;     // Write i lives in jobs[(i - 1) % SETTING_WRITE_JOBS]
+static uint32_t started = 0;    // Writes up to this id went to the bus
+static bool busy = false;       // A write or its read back is on the bus
+static uint16_t readbackWord;
+static uint64_t lastWrite[sizeof(inverter_settings) / sizeof(inverter_settings[0])];   // millis64() of the last accepted one
+static bool written[sizeof(inverter_settings) / sizeof(inverter_settings[0])];
+
+int8_t findSetting(const char *key) {
+  for (uint8_t i = 0; i < INVERTER_SETTINGS; i++) {
+    if (!strcmp(inverter_settings[i].key, key)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool inRange(const InverterSetting &s, uint16_t value) {
+  if (value < s.min || value > s.max) {
+    return false;
+  }
+  if (!s.choices[0]) {
+    return true;
+  }
+  for (uint8_t i = 0; i < SETTING_CHOICES_MAX && s.choices[i]; i++) {
+    if (s.choices[i] == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SettingSubmit settingWrite(const char *key, uint16_t value, uint32_t &id) {
+  int8_t i = findSetting(key);
+  if (i < 0) {
+    return SUBMIT_UNKNOWN;
+  }
+  if (!inRange(inverter_settings[i], value)) {
+    return SUBMIT_RANGE;
+  }
+
+  uint64_t now = millis64();
+  SettingSubmit result = SUBMIT_OK;
+
+  SET_LOCK();
+  SettingWrite &slot = jobs[latest % SETTING_WRITE_JOBS];
+  if (written[i] && now - lastWrite[i] < SETTING_WRITE_INTERVAL * 1000UL) {
+    result = SUBMIT_RATE_LIMITED;
+  } else if (slot.id && slot.state < WRITE_DONE) {
+    result = SUBMIT_FULL;
+  } else {
+    lastWrite[i] = now;
+    written[i] = true;
+    slot = {};
+    slot.id = ++latest;
+    slot.setting = i;
+    slot.value = value;
+    slot.state = WRITE_QUEUED;
+    slot.queued = uptime();
+    id = slot.id;
+  }
+  SET_UNLOCK();
+
+  if (result == SUBMIT_OK) {
+    LOGI("Write %u queued: %s = %u", id, key, value);
+  }
+  return result;
+}
+
+bool settingWriteStatus(uint32_t id, SettingWrite &out) {
+  SET_LOCK();
+  bool found = id && id <= latest && id + SETTING_WRITE_JOBS > latest;
+  if (found) {
+    out = jobs[(id - 1) % SETTING_WRITE_JOBS];
+  }
+  SET_UNLOCK();
+  return found;
+}
+
+uint32_t settingWritesLatest() {
+  SET_LOCK();
+  uint32_t id = latest;
+  SET_UNLOCK();
+  return id;
+}
+
+const char *settingWriteStateName(uint8_t state) {
+  return state < sizeof(state_names) / sizeof(state_names[0]) ? state_names[state] : "?";
+}
+
+static void finish(SettingWrite &job, SettingWriteState state, uint8_t result) {
+  SET_LOCK();
+  job.state = state;
+  job.result = result;
+  job.finished = uptime();
+  SET_UNLOCK();
+  busy = false;
+
+  const InverterSetting &s = inverter_settings[job.setting];
+  if (state == WRITE_DONE) {
+    LOGI("Write %u done: %s = %u", job.id, s.key, job.value);
+  } else if (state == WRITE_MISMATCH) {
+    LOGW("Write %u: %s = %u reads back %u", job.id, s.key, job.value, job.readback);
+  } else {
+    LOGW("Write %u failed: %s = %u, result 0x%X", job.id, s.key, job.value, result);
+  }
+}
+
+static void readbackDone(const ModbusRequest &req) {
+  SettingWrite &job = *(SettingWrite *)req.ctx;
+  if (req.result != MB_SUCCESS) {
+    finish(job, WRITE_FAILED, req.result);
+    return;
+  }
+
+  // Read back swapped like every other register
+  const InverterSetting &s = inverter_settings[job.setting];
+  uint16_t word = htons(readbackWord);
+  uint16_t value = s.mask ? (word & s.mask) != 0 : word;
+
+  SET_LOCK();
+  job.readback = value;
+  SET_UNLOCK();
+
+  // The snapshot catches up on the next cycle
+  refreshRegisterGroup(REG_GROUP_SETTINGS);
+  finish(job, value == job.value ? WRITE_DONE : WRITE_MISMATCH, MB_SUCCESS);
+}
+
+static void writeDone(const ModbusRequest &req) {
+  SettingWrite &job = *(SettingWrite *)req.ctx;
+  if (req.result != MB_SUCCESS) {
+    finish(job, WRITE_FAILED, req.result);
+    return;
+  }
+
+  ModbusRequest read = ModbusRtu::readRequest(inverter_settings[job.setting].readback, 1, &readbackWord);
+  read.retries = RETRY_COUNT;
+  read.callback = readbackDone;
+  read.ctx = &job;
+
+  SET_LOCK();
+  job.state = WRITE_VERIFYING;
+  SET_UNLOCK();
+
+  if (!mbus.submit(read)) {
+    finish(job, WRITE_FAILED, MB_CANCELLED);
+  }
+}
+
+void settingsLoop() {
+  if (busy) {
+    return;
+  }
+
+  SET_LOCK();
+  bool next = started < latest;
+  SettingWrite *job = nullptr;
+  if (next) {
+    job = &jobs[started % SETTING_WRITE_JOBS];
+    started++;
+    job->state = WRITE_SENDING;
+  }
+  SET_UNLOCK();
+
+  if (!next) {
+    return;
+  }
+
+  const InverterSetting &s = inverter_settings[job->setting];
+  ModbusRequest req = ModbusRtu::writeRequest(s.address, job->value);
+  req.retries = RETRY_COUNT;
+  req.callback = writeDone;
+  req.ctx = job;
+
+  busy = true;
+  LOGD("Writing %u to %u (%s)", job->value, s.address, s.key);
+  if (!mbus.submit(req)) {
+    finish(*job, WRITE_FAILED, MB_CANCELLED);
+  }
+}
@@ -0,0 +1,74 @@
+// Inverter settings header
+// Writes to the settings registers 5002-5033. Queued from any task and sent
+// by the acquisition task between its reads: the write (function 06), then
+// a read of the register that reports the setting to verify it.
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+
+#define SETTING_CHOICES_MAX 8
+
+// A writable setting. Only the ones with a documented range and a register
+// to read them back are listed, see extras/registers-map.md.
+struct InverterSetting {
+  const char *key;
+  uint16_t address;          // Write register
+  uint16_t readback;         // Read register that reports the setting
+  uint16_t mask;             // Bit of readback for an on/off setting, 0 for the whole word
+  uint16_t min;
+  uint16_t max;
+  uint16_t choices[SETTING_CHOICES_MAX];   // Allowed values within min-max, all of them if none
+  const char *name;
+};
+
+extern const InverterSetting inverter_settings[];
+extern const uint8_t INVERTER_SETTINGS;
+
+enum SettingWriteState : uint8_t {
+  WRITE_QUEUED,
+  WRITE_SENDING,
+  WRITE_VERIFYING,
+  WRITE_DONE,        // Read back as written
+  WRITE_MISMATCH,    // Accepted, but reads back something else
+  WRITE_FAILED,      // Write or read back failed, see result
+};
+
+struct SettingWrite {
+  uint32_t id;               // Increases by one per accepted write, from 1
+  uint8_t setting;           // Index in inverter_settings
+  uint16_t value;
+  SettingWriteState state;
+  uint8_t result;            // Modbus result of the step that failed
+  uint16_t readback;         // Value read back, 0 or 1 for an on/off setting
+  unsigned int queued;       // uptime() when accepted
+  unsigned int finished;     // uptime() when done, 0 before
+};
+
+enum SettingSubmit : uint8_t {
+  SUBMIT_OK,
+  SUBMIT_UNKNOWN,            // No such setting
+  SUBMIT_RANGE,              // Value outside the documented range
+  SUBMIT_RATE_LIMITED,       // Same setting written less than SETTING_WRITE_INTERVAL ago
+  SUBMIT_FULL,               // SETTING_WRITE_JOBS writes still pending
+};
+
+// Setting with this key, -1 if none
+int8_t findSetting(const char *key);
+
+// Queue a write, safe from any task. id is that of the queued write.
+SettingSubmit settingWrite(const char *key, uint16_t value, uint32_t &id);
+
+// State of a write still in the ring, false if none
+bool settingWriteStatus(uint32_t id, SettingWrite &out);
+
+// Id of the newest write, 0 before the first
+uint32_t settingWritesLatest();
+
+// Start the next queued write, acquisition task only
+void settingsLoop();
+
+const char *settingWriteStateName(uint8_t state);
+
+#endif // SETTINGS_H
@@ -0,0 +1,51 @@
+// Published inverter samples implementation
+// Versioned double buffer: sample N lives in buffers[N & 1] and the
+// acquisition task only ever writes the buffer of sample N + 1. Readers
+// copy without a lock and retry in the rare case a newer sample got
+// published while they were copying, since the one after that reuses
+// their buffer.
+
+#include "snapshot.h"
+#include "globals.h"
+#include "modbus.h"
+#include "utils.h"
+#include <atomic>
+
+static Snapshot buffers[2];
+static std::atomic<uint32_t> published(0);
+
+// Copy the working globals into the next buffer and publish it
+const Snapshot &publishSnapshot() {
+  uint32_t seq = published.load(std::memory_order_relaxed) + 1;
+  Snapshot &next = buffers[seq & 1];
+
+  next.seq = seq;
+  next.ac = ac;
+  next.dc = dc;
+  next.inverter = inverter;
+  next.read_interval = dynamic_read_interval;
+  next.chunk_size = chunk_size;
+  for (uint8_t i = 0; i < REG_GROUPS; i++) {
+    next.updated[i] = reg_groups[i].updated;
+  }
+  next.taken = millis();
+  next.uptime = uptime();
+
+  published.store(seq, std::memory_order_release);
+  return next;
+}
+
+// Copy the latest published sample, consistent as a whole
+void readSnapshot(Snapshot &out) {
+  uint32_t seq;
+  do {
+    seq = published.load(std::memory_order_acquire);
+    out = buffers[seq & 1];
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (published.load(std::memory_order_relaxed) != seq);
+}
+
+// Sequence number of the latest published sample, 0 before the first one
+uint32_t snapshotSeq() {
+  return published.load(std::memory_order_acquire);
+}
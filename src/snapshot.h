@@ -0,0 +1,34 @@
+// Published inverter samples header
+// Lock-free versioned double buffer between the acquisition task and its
+// readers
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+#include "data.h"
+
+// One complete sample, as seen by the web, OTA and logging paths
+struct Snapshot {
+  uint32_t seq;                       // Increases by one per published sample
+  ACData ac;
+  DCData dc;
+  InverterData inverter;
+  float read_interval;
+  uint8_t chunk_size;
+  unsigned int updated[REG_GROUPS];   // uptime() of each register group's last read
+  unsigned long taken;                // millis() when published
+  unsigned int uptime;                // uptime() when published
+};
+
+// Acquisition side, single writer: copy the working globals and publish them.
+// The returned sample stays valid until the writer's next publish.
+const Snapshot &publishSnapshot();
+
+// Reader side, any task: consistent copy of the latest published sample
+void readSnapshot(Snapshot &out);
+
+// Sequence number of the latest published sample, cheap change check
+uint32_t snapshotSeq();
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,238 @@
+// Status fields table implementation
+// Single source for the register decoder, the /api/status layout and the
+// dashboard /names.json. A new inverter register is one REGISTER() line
+// here plus the member it decodes into.
+
+#include "status_fields.h"
+#include "globals.h"
+
+#define REG_UNSIGNED false
+#define REG_SIGNED true
+
+// Field ids are part of the /api/status.cbor format: never renumber or reuse
+// one, give new fields the next free id
+#define FIELD(id, section, key, member, precision, name, unit, description) \
+  {id, section, key, fieldType<std::decay<decltype(((Snapshot *)0)->member)>::type>(), precision, \
+   offsetof(Snapshot, member), name, unit, description, 0, 1, false, nullptr}
+
+// Field read from an inverter register: value = register / scale, decoded
+// into the working global of the same name (ac, dc or inverter)
+#define REGISTER(id, section, address, scale, sign, key, member, precision, name, unit, description) \
+  {id, section, key, fieldType<std::decay<decltype(((Snapshot *)0)->member)>::type>(), precision, \
+   offsetof(Snapshot, member), name, unit, description, address, scale, sign, &member}
+
+enum : uint8_t {
+  SECTION_AC,
+  SECTION_DC,
+  SECTION_PV,
+  SECTION_INVERTER,
+  SECTION_UPDATED,
+};
+static_assert(SECTION_INVERTER == STATUS_SECTION_INVERTER, "STATUS_SECTION_INVERTER out of date");
+
+const StatusSection status_sections[] = {
+  {"ac", "AC Power Section",
+   "AC power measurements including input and output characteristics"},
+  {"dc", "DC Power Section",
+   "Direct current measurements including battery, solar, and charging parameters"},
+  {"pv", "Photovoltaic Power Section",
+   "Photovoltaic measurements"},
+  {"inverter", "Inverter System Section",
+   "Inverter/charger system status, settings, and operational parameters"},
+  {"updated", "Register Groups",
+   "Uptime of the last good read of each register group"},
+};
+
+const uint8_t STATUS_SECTIONS = sizeof(status_sections) / sizeof(status_sections[0]);
+
+constexpr StatusField status_fields[] = {
+  REGISTER(1, SECTION_AC, 4502, 10, REG_UNSIGNED, "input_voltage", ac.input_voltage, 1, "AC Input Voltage", "V",
+        "Voltage level of the incoming AC power supply"),
+  REGISTER(2, SECTION_AC, 4503, 10, REG_UNSIGNED, "input_freq", ac.input_freq, 1, "AC Input Frequency", "Hz",
+        "The frequency of the incoming AC power supply"),
+  REGISTER(3, SECTION_AC, 4510, 10, REG_UNSIGNED, "output_voltage", ac.output_voltage, 1, "AC Output Voltage", "V",
+        "Voltage level of the inverter's AC output"),
+  REGISTER(4, SECTION_AC, 4511, 10, REG_UNSIGNED, "output_freq", ac.output_freq, 1, "AC Output Frequency", "Hz",
+        "Frequency of the inverter's AC output power"),
+  REGISTER(5, SECTION_AC, 4514, 1, REG_UNSIGNED, "output_load_percent", ac.output_load_percent, 0, "Output Load Percentage", "%",
+        "Percentage of maximum load capacity currently being used"),
+  FIELD(6, SECTION_AC, "power_factor", ac.power_factor, 2, "AC power Factor", "",
+        "Ratio of the load that is resistive"),
+  REGISTER(7, SECTION_AC, 4512, 1, REG_UNSIGNED, "output_va", ac.output_va, 0, "Output Apparent Power", "VA",
+        "Apparent power output in volt-amperes"),
+  REGISTER(8, SECTION_AC, 4513, 1, REG_UNSIGNED, "output_watts", ac.output_watts, 0, "Output Real Power", "W",
+        "Actual power consumption in watts (real power)"),
+
+  REGISTER(9, SECTION_DC, 4506, 10, REG_UNSIGNED, "voltage", dc.voltage, 1, "Battery Voltage", "V",
+        "The raw voltage measurement of the battery bank"),
+  FIELD(10, SECTION_DC, "voltage_corrected", dc.voltage_corrected, 2, "Corrected Battery Voltage", "V",
+        "Battery voltage adjusted with compensation factor"),
+  FIELD(11, SECTION_DC, "charge_power", dc.charge_power, 1, "Battery Charge Power", "W",
+        "Power being delivered to the battery during charging"),
+  FIELD(12, SECTION_DC, "discharge_power", dc.discharge_power, 1, "Battery Discharge Power", "W",
+        "Power being drawn from the battery during discharge"),
+  REGISTER(13, SECTION_DC, 4508, 1, REG_UNSIGNED, "charge_current", dc.charge_current, 1, "Battery Charge Current", "A",
+        "Current flowing into the battery during charging"),
+  REGISTER(14, SECTION_DC, 4509, 1, REG_UNSIGNED, "discharge_current", dc.discharge_current, 1, "Battery Discharge Current", "A",
+        "Current flowing out of the battery during discharge"),
+  FIELD(15, SECTION_DC, "new_k", dc.new_k, 4, "New Calibration Factor", "",
+        "Recently calculated calibration coefficient (purpose varies)"),
+  FIELD(16, SECTION_DC, "batt_v_compensation_k", dc.batt_v_compensation_k, 4, "Battery Voltage Compensation Factor", "V/V",
+        "Compensation coefficient for battery voltage readings"),
+
+  REGISTER(17, SECTION_PV, 4504, 10, REG_UNSIGNED, "pv_voltage", dc.pv_voltage, 1, "Solar PV Voltage", "V",
+        "Voltage output from photovoltaic solar panels"),
+  REGISTER(18, SECTION_PV, 4505, 1, REG_UNSIGNED, "pv_power", dc.pv_power, 0, "Solar PV Power", "W",
+        "Instantaneous power generation from solar panels"),
+  FIELD(19, SECTION_PV, "pv_current", dc.pv_current, 2, "Solar PV Current", "A",
+        "Current output from photovoltaic solar panels"),
+  FIELD(20, SECTION_PV, "pv_energy_produced", dc.pv_energy_produced, 1, "Solar Energy Produced", "Wh",
+        "Cumulative energy generated by solar panels"),
+
+  FIELD(21, SECTION_INVERTER, "valid_info", inverter.valid_info, 0, "Data Validity Flag", "",
+        "Indicates whether current readings are valid (1) or not (0)"),
+  REGISTER(22, SECTION_INVERTER, 4501, 1, REG_UNSIGNED, "op_mode", inverter.op_mode, 0, "Operating Mode", "",
+        "Current operating mode of the inverter/charger system"),
+  FIELD(23, SECTION_INVERTER, "soc", inverter.soc, 1, "State of Charge", "%",
+        "Battery charge level expressed as a percentage"),
+  FIELD(24, SECTION_INVERTER, "gas_gauge", inverter.gas_gauge, 1, "Battery Gas Gauge", "%",
+        "Battery capacity estimation/fuel gauge reading"),
+  FIELD(25, SECTION_INVERTER, "battery_energy", inverter.battery_energy, 1, "Battery Energy Content", "Wh",
+        "Estimated energy stored in the battery bank"),
+  REGISTER(26, SECTION_INVERTER, 4557, 1, REG_SIGNED, "temp", inverter.temp, 0, "Inverter Temperature", "°C",
+        "Internal temperature of the inverter unit"),
+  FIELD(27, SECTION_INVERTER, "read_interval", read_interval, 1, "Data Read Interval", "s",
+        "Time between sensor data readings in seconds"),
+  FIELD(28, SECTION_INVERTER, "read_time", inverter.read_time, 2, "Last Read Time", "s",
+        "Time taken for the most recent data read operation"),
+  FIELD(29, SECTION_INVERTER, "read_time_mean", inverter.read_time_mean, 2, "Average Read Time", "s",
+        "Average time taken for data read operations"),
+  FIELD(30, SECTION_INVERTER, "chunk_size", chunk_size, 0, "Modbus Chunk Size", "",
+        "Registers read per Modbus transaction, probed per inverter"),
+  REGISTER(31, SECTION_INVERTER, 4555, 1, REG_UNSIGNED, "charger", inverter.charger, 0, "Charger Status", "",
+        "Current state/status of the battery charging system"),
+  REGISTER(32, SECTION_INVERTER, 4536, 1, REG_UNSIGNED, "charger_source_priority", inverter.charger_source_priority, 0, "Charger Source Priority", "",
+        "Charger source priority setting (settings menu 16)"),
+  REGISTER(33, SECTION_INVERTER, 4537, 1, REG_UNSIGNED, "output_source_priority", inverter.output_source_priority, 0, "Output Source Priority", "",
+        "Output source priority setting (settings menu 1)"),
+  FIELD(34, SECTION_INVERTER, "eff_w", inverter.eff_w, 1, "Real Power Efficiency", "%",
+        "Efficiency calculation based on real power"),
+  FIELD(35, SECTION_INVERTER, "energy_spent_ac", inverter.energy_spent_ac, 1, "AC Energy Consumed", "Wh",
+        "Cumulative energy consumed from AC output"),
+  FIELD(36, SECTION_INVERTER, "energy_source_ac", inverter.energy_source_ac, 1, "AC Source Percentage", "%",
+        "Percentage of output power sourced from AC input"),
+  FIELD(37, SECTION_INVERTER, "energy_source_batt", inverter.energy_source_batt, 1, "Battery Source Percentage", "%",
+        "Percentage of output power sourced from battery"),
+  FIELD(38, SECTION_INVERTER, "energy_source_pv", inverter.energy_source_pv, 1, "Solar Source Percentage", "%",
+        "Percentage of output power sourced from solar panels"),
+  FIELD(39, SECTION_INVERTER, "autonomy", inverter.autonomy, 0, "Battery Autonomy", "",
+        "Estimated remaining runtime in minutes based on current consumption and battery energy"),
+  FIELD(40, SECTION_INVERTER, "uptime", uptime, 0, "System Uptime", "s",
+        "Time since system startup in seconds"),
+  REGISTER(44, SECTION_INVERTER, 4530, 1, REG_UNSIGNED, "fault_code", inverter.fault_code, 0, "Fault Code", "",
+        "Fault code shown by the inverter, 0 when there is none"),
+  REGISTER(45, SECTION_INVERTER, 4516, 1, REG_UNSIGNED, "status_4516", inverter.status_4516, 0, "Status Word 4516", "",
+        "Raw status bits of register 4516"),
+  REGISTER(46, SECTION_INVERTER, 4553, 1, REG_UNSIGNED, "status_4553", inverter.status_4553, 0, "Status Word 4553", "",
+        "Raw status bits of register 4553"),
+  REGISTER(47, SECTION_INVERTER, 4554, 1, REG_UNSIGNED, "status_4554", inverter.status_4554, 0, "Status Word 4554", "",
+        "Raw status bits of register 4554"),
+  FIELD(48, SECTION_INVERTER, "ac_active", inverter.ac_active, 0, "Grid Present", "",
+        "1 while the AC input is active"),
+  FIELD(49, SECTION_INVERTER, "on_battery", inverter.on_battery, 0, "On Battery", "",
+        "1 while the load runs from the battery"),
+  FIELD(50, SECTION_INVERTER, "load_on", inverter.load_on, 0, "Load Enabled", "",
+        "1 while the AC output is on"),
+  FIELD(51, SECTION_INVERTER, "overload", inverter.overload, 0, "Overload", "",
+        "1 while the inverter reports an overload"),
+
+  FIELD(41, SECTION_UPDATED, "measure", updated[0], 0, "Measurements", "s",
+        "AC, PV, battery and load registers (4501-4516), read every cycle"),
+  FIELD(42, SECTION_UPDATED, "status", updated[1], 0, "Status", "s",
+        "Status flags, charger status and temperature (4553-4561), read every cycle"),
+  FIELD(43, SECTION_UPDATED, "settings", updated[2], 0, "Settings", "s",
+        "Priorities, charge voltages and equalization (4517-4552), read every few minutes"),
+  FIELD(52, SECTION_UPDATED, "fault", updated[3], 0, "Fault Code", "s",
+        "Fault code register (4530), read every cycle"),
+};
+
+const uint8_t STATUS_FIELDS = sizeof(status_fields) / sizeof(status_fields[0]);
+static_assert(sizeof(status_fields) / sizeof(status_fields[0]) <= STATUS_FIELDS_MAX, "raise STATUS_FIELDS_MAX");
+
+// Every register within the block the register groups read, with a scale,
+// and signed ones only into floats
+constexpr bool registersValid(uint8_t i = 0) {
+  return i == sizeof(status_fields) / sizeof(status_fields[0]) ||
+         ((!status_fields[i].address ||
+           (status_fields[i].address >= MBUS_FIRST_REGISTER &&
+            status_fields[i].address < MBUS_FIRST_REGISTER + MBUS_REGISTERS &&
+            status_fields[i].scale > 0 &&
+            (!status_fields[i].is_signed || status_fields[i].type == FIELD_FLOAT))) &&
+          registersValid(i + 1));
+}
+static_assert(registersValid(), "register outside 4501-4561, without a scale, or signed into an unsigned member");
+
+// Value of a field in a snapshot, integers converted
+float fieldValue(const Snapshot &snap, const StatusField &field) {
+  const uint8_t *p = (const uint8_t *)&snap + field.offset;
+
+  switch (field.type) {
+    case FIELD_FLOAT: {
+      float v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case FIELD_U8:
+      return *p;
+    case FIELD_U16: {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default: {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+  }
+}
+
+void decodeRegisters(const uint16_t *regs) {
+  for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+    const StatusField &f = status_fields[i];
+    if (!f.address) {
+      continue;
+    }
+
+    // The inverter sends its words little endian
+    uint16_t raw = htons(regs[f.address - MBUS_FIRST_REGISTER]);
+    float v = (f.is_signed ? (float)(int16_t)raw : (float)raw) / f.scale;
+
+    switch (f.type) {
+      case FIELD_FLOAT:
+        *(float *)f.live = v;
+        break;
+      case FIELD_U8:
+        *(uint8_t *)f.live = v;
+        break;
+      case FIELD_U16:
+        *(uint16_t *)f.live = v;
+        break;
+      default:
+        *(uint32_t *)f.live = v;
+        break;
+    }
+  }
+}
+
+// Field named "section.key", NULL if there is none
+const StatusField *findField(const char *name) {
+  for (uint8_t i = 0; i < STATUS_FIELDS; i++) {
+    const char *section = status_sections[status_fields[i].section].key;
+    size_t n = strlen(section);
+    if (strncmp(name, section, n) == 0 && name[n] == '.' && strcmp(name + n + 1, status_fields[i].key) == 0) {
+      return &status_fields[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,79 @@
+// Status fields table header
+// One entry per value published in /api/status: where it lives in a
+// Snapshot, how it is formatted and how the dashboard labels it. Entries
+// read straight from an inverter register also say how to decode it.
+
+#ifndef STATUS_FIELDS_H
+#define STATUS_FIELDS_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <type_traits>
+#include "snapshot.h"
+
+enum FieldType : uint8_t {
+  FIELD_FLOAT,
+  FIELD_U8,
+  FIELD_U16,
+  FIELD_U32,
+};
+
+// Storage type of a Snapshot member, all integers in it are unsigned
+template <typename T>
+constexpr FieldType fieldType() {
+  static_assert(std::is_floating_point<T>::value || (std::is_unsigned<T>::value && sizeof(T) <= 4),
+                "status fields are floats or unsigned integers up to 32 bits");
+  return std::is_floating_point<T>::value ? FIELD_FLOAT
+       : sizeof(T) == 1 ? FIELD_U8
+       : sizeof(T) == 2 ? FIELD_U16
+       : FIELD_U32;
+}
+
+// JSON object of the status document, and its panel in the dashboard
+struct StatusSection {
+  const char *key;
+  const char *name;
+  const char *description;
+};
+
+// Id of the sample sequence number in /api/status.cbor
+#define STATUS_FIELD_SEQ 0
+
+// Section of /api/status that ends with json_size
+#define STATUS_SECTION_INVERTER 3
+
+struct StatusField {
+  uint8_t id;               // Stable key in /api/status.cbor
+  uint8_t section;          // Index in status_sections
+  const char *key;
+  FieldType type;
+  uint8_t precision;        // Decimals, floats only
+  uint16_t offset;          // offsetof(Snapshot, member)
+  const char *name;
+  const char *unit;
+  const char *description;
+  uint16_t address;         // Inverter register, 0 for computed fields
+  uint16_t scale;           // Register value divided by this
+  bool is_signed;           // Register is a two's complement int16
+  void *live;               // Working global the register decodes into
+};
+
+extern const StatusSection status_sections[];
+extern const uint8_t STATUS_SECTIONS;
+
+// Sorted by section
+extern const StatusField status_fields[];
+extern const uint8_t STATUS_FIELDS;
+#define STATUS_FIELDS_MAX 64   // For per-field state sized at compile time
+
+// Value of a field in a snapshot, integers converted
+float fieldValue(const Snapshot &snap, const StatusField &field);
+
+// Decode the registers of the fields table into the working globals,
+// regs[0] being MBUS_FIRST_REGISTER as the inverter sent it
+void decodeRegisters(const uint16_t *regs);
+
+// Field named "section.key", NULL if there is none
+const StatusField *findField(const char *name);
+
+#endif // STATUS_FIELDS_H
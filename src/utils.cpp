@@ -4,46 +4,23 @@
 #include "utils.h"
 #include "globals.h"
 #include <Arduino.h>
+#ifndef NATIVE
+  #include <esp_timer.h>
+#endif
 
-// Get uptime in seconds
-unsigned int uptime() {
-  unsigned long uptime_sec = millis() / 1000;
-  return (unsigned int)(uptime_sec);
+// Milliseconds since boot from the 64 bit esp_timer, where millis() wraps
+// after 49 days
+uint64_t millis64() {
+  #ifdef NATIVE
+    return millis();
+  #else
+    return esp_timer_get_time() / 1000;
+  #endif
 }
 
-// Check if time interval has elapsed, handling millis() rollover
-bool hasTimeElapsed(unsigned long &lastTime, unsigned long currentTime, unsigned long interval) {
-  unsigned long timeDiff;
-  if (currentTime < lastTime) {
-    // Rollover occurred
-    timeDiff = (0xFFFFFFFF - lastTime) + currentTime + 1;
-  } else {
-    timeDiff = currentTime - lastTime;
-  }
-  return (timeDiff >= interval);
-}
-
-// Calculate next read interval based on average read time
-float calculateNextInterval() {
-  if (inverter.read_time_mean == 0.0) {
-    return (float)(INITIAL_READ_INTERVAL);
-  }
-  
-  // Round up to next 5 second multiple
-  float base = int(inverter.read_time_mean / 5) * 5;
-  if (fmod(inverter.read_time_mean, 5.0) != 0.0) {
-    base += 5.0;
-  }
-  
-  // Ensure minimum of 5 seconds max of 30 seconds
-  if (base < 5.0) {
-    base = 5.0;
-  }
-  if (base > 30.0) {
-    base = 30.0;
-  }
-  
-  return base;
+// Get uptime in seconds
+unsigned int uptime() {
+  return (unsigned int)(millis64() / 1000);
 }
 
 // Calculate dynamic alpha for EWMA based on 5-minute window
@@ -60,3 +37,15 @@ void calculateEWMA(float &avg, float newVal, float alpha) {
   float temp_avg = alpha * newVal + (1.0 - alpha) * avg;
   avg = temp_avg;
 }
+
+// CRC-16/MODBUS, also guards the records of the sample log
+uint16_t crc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+  }
+  return crc;
+}
@@ -7,12 +7,14 @@
 #include <Arduino.h>
 
 // Timing utilities
+uint64_t millis64();
 unsigned int uptime();
-bool hasTimeElapsed(unsigned long &lastTime, unsigned long currentTime, unsigned long interval);
-float calculateNextInterval();
 float calculateDynamicAlpha();
 
 // EWMA calculation
 void calculateEWMA(float &avg, float newVal, float alpha);
 
+// CRC-16/MODBUS, also guards the records of the sample log
+uint16_t crc16(const uint8_t *data, size_t len);
+
 #endif // UTILS_H
@@ -0,0 +1,109 @@
+// Outage watchdog implementation
+// Two registers are 8 bytes out and 9 back, about 70 ms of wire time at
+// 2400 baud plus the inverter's reply latency; the counters measure what
+// that costs on the real link.
+
+#include "watchdog.h"
+#include "config.h"
+#include "globals.h"
+#include "modbus.h"
+#include "events.h"
+#include "utils.h"
+#include "log.h"
+#include "perf.h"
+
+#define LOG_MODULE LOG_MODBUS
+
+#ifdef NATIVE
+  #define WD_LOCK()
+  #define WD_UNLOCK()
+#else
+  static portMUX_TYPE watchdogMux = portMUX_INITIALIZER_UNLOCKED;
+  #define WD_LOCK() portENTER_CRITICAL(&watchdogMux)
+  #define WD_UNLOCK() portEXIT_CRITICAL(&watchdogMux)
+#endif
+
+static WatchdogStats stats = {};
+
+// Read the status words, MB_SUCCESS or the Modbus error
+static uint8_t readStatusWords(uint16_t *regs) {
+  PERF_SCOPE(PERF_WATCHDOG);
+  ModbusFuture future;
+  ModbusRequest req = ModbusRtu::readRequest(WATCHDOG_FIRST_REGISTER, WATCHDOG_REGISTERS, regs);
+  req.timeout_ms = WATCHDOG_TIMEOUT_MS;
+  req.retries = 0;
+  req.future = &future;
+
+  if (!mbus.submit(req)) {
+    return MB_CANCELLED;
+  }
+  return mbus.await(future);
+}
+
+bool watchdogPoll(unsigned long untilRead) {
+  // Nothing to compare with yet, or the full read comes first anyway
+  if (!inverter.valid_info || untilRead < WATCHDOG_INTERVAL_MS) {
+    return false;
+  }
+
+  uint16_t regs[WATCHDOG_REGISTERS];
+  uint32_t start = perfNow();
+  uint8_t result = readStatusWords(regs);
+  uint32_t busy = perfNow() - start;
+
+  WD_LOCK();
+  stats.polls++;
+  stats.busy_us += busy;
+  if (busy > stats.max_us) {
+    stats.max_us = busy;
+  }
+  if (result != MB_SUCCESS) {
+    stats.failures++;
+  }
+  WD_UNLOCK();
+
+  // A missed poll is retried at the next interval, the full reads carry on
+  if (result != MB_SUCCESS) {
+    LOGD("Watchdog poll failed, result 0x%X", result);
+    return false;
+  }
+
+  // Compare with the last full read, words swapped like decodeRegisters() does
+  InverterData probe = inverter;
+  probe.status_4553 = htons(regs[0]);
+  probe.status_4554 = htons(regs[1]);
+  decodeStatusFlags(probe);
+  if (probe.ac_active == inverter.ac_active && probe.on_battery == inverter.on_battery &&
+      probe.load_on == inverter.load_on) {
+    return false;
+  }
+
+  WD_LOCK();
+  stats.triggers++;
+  WD_UNLOCK();
+
+  LOGI("Watchdog: status 0x%04X 0x%04X, grid %s, reading now", probe.status_4553, probe.status_4554,
+       probe.ac_active ? "on" : "off");
+  eventsWatchdog(probe);
+  return true;
+}
+
+void watchdogStats(WatchdogStats &out) {
+  unsigned int now = uptime();
+  float interval = dynamic_read_interval;
+  float readLoad = interval > 0 ? inverter.read_time_mean / interval : 0;
+
+  WD_LOCK();
+  out = stats;
+  WD_UNLOCK();
+  out.at = now;
+  out.read_load = readLoad;
+}
+
+void watchdogReset() {
+  unsigned int now = uptime();
+  WD_LOCK();
+  stats = {};
+  stats.since = now;
+  WD_UNLOCK();
+}
@@ -0,0 +1,41 @@
+// Outage watchdog header
+// Between full reads, polls only the status words 4553-4554 in one short
+// transaction, so a grid loss shows up within WATCHDOG_INTERVAL_MS rather
+// than a whole read interval. A change raises its events at once and asks
+// the acquisition task for a full read.
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <Arduino.h>
+
+#define WATCHDOG_FIRST_REGISTER 4553
+#define WATCHDOG_REGISTERS 2
+
+struct WatchdogStats {
+  uint32_t polls;         // Transactions sent
+  uint32_t failures;      // Polls without a good reply
+  uint32_t triggers;      // Flag changes that started a full read
+  uint64_t busy_us;       // Bus time of the polls, submit to completion
+  uint32_t max_us;
+  unsigned int since;     // uptime() of the last reset
+  unsigned int at;        // uptime() when copied by watchdogStats()
+  float read_load;        // Bus share of the full reads at that time
+
+  // Share of the time the bus spent on the watchdog
+  float load() const {
+    return at > since ? busy_us / 1e6 / (at - since) : 0;
+  }
+};
+
+// Poll the status words, every WATCHDOG_INTERVAL_MS from the acquisition
+// task. untilRead is the time in ms left before the next full read, which
+// makes a poll pointless when short. True when the flags changed since the
+// last full read: read now.
+bool watchdogPoll(unsigned long untilRead);
+
+// Counters since the last reset, safe from any task
+void watchdogStats(WatchdogStats &out);
+void watchdogReset();
+
+#endif // WATCHDOG_H
@@ -5,19 +5,24 @@
 #include <WebSerial.h>
 #include <SPIFFS.h>
 #include <FS.h>
+#include <memory>
+#include <vector>
 #include "webserver.h"
 #include "globals.h"
 #include "json_utils.h"
+#include "snapshot.h"
+#include "history.h"
+#include "sample_log.h"
+#include "metrics.h"
+#include "assets.h"
+#include "perf.h"
+#include "events.h"
+#include "watchdog.h"
+#include "settings.h"
+#include "scheduler.h"
+#include "log.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
+#define LOG_MODULE LOG_WEB
 
 // 404 handler - redirect to /
 void notFound(AsyncWebServerRequest *request) {
@@ -26,42 +31,439 @@ void notFound(AsyncWebServerRequest *request) {
 
 // Serve index.html
 void serveIndex(AsyncWebServerRequest *request) {
-  request->send(SPIFFS, "/index.html");
-  #ifdef VERBOSE_SERIAL
-    sprintln("/ ");
-  #endif
+  sendAsset(request, "/index.html");
+  LOGD("GET /");
+}
+
+// Serve a status payload, 304 when the client already has this sample. The
+// body is copied: the cache slot is reused two samples later, possibly
+// before a slow client has read it all.
+static void sendStatus(AsyncWebServerRequest *request, StatusFormat format, const char *type) {
+  size_t len;
+  const char *etag;
+  const char *payload = statusPayload(format, len, etag);
+
+  if (len == 0) {
+    request->send(500, "text/plain", "Status unavailable");
+    return;
+  }
+
+  AsyncWebServerResponse *response;
+  const AsyncWebHeader *match = request->getHeader("If-None-Match");
+  if (match && match->value() == etag) {
+    response = request->beginResponse(304);
+  } else {
+    std::shared_ptr<std::vector<uint8_t>> body =
+        std::make_shared<std::vector<uint8_t>>((const uint8_t *)payload, (const uint8_t *)payload + len);
+    response = request->beginResponse(type, len,
+      [body](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        size_t n = min(maxLen, body->size() - index);
+        memcpy(buffer, body->data() + index, n);
+        return n;
+      });
+  }
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
 }
 
 // Serve status JSON
 void serveStatus(AsyncWebServerRequest *request) {
-  request->send(200, "application/json", dataJson());
-  #ifdef VERBOSE_SERIAL
-    sprintln("/status");
-  #endif
+  sendStatus(request, STATUS_JSON, "application/json");
+  LOGD("GET /api/status");
+}
+
+// Serve status CBOR, keyed by the field ids of /api/fields
+void serveStatusCbor(AsyncWebServerRequest *request) {
+  sendStatus(request, STATUS_CBOR, "application/cbor");
+  LOGD("GET /api/status.cbor");
+}
+
+// Serve the field id manifest of /api/status.cbor
+void serveFields(AsyncWebServerRequest *request) {
+  request->send(request->beginChunkedResponse("application/json",
+    [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      fieldsJson(w);
+      return w.length();
+    }));
+  LOGD("GET /api/fields");
 }
 
 // Serve style.css
 void serveCSS(AsyncWebServerRequest *request) {
-  request->send(SPIFFS, "/style.css");
-  #ifdef VERBOSE_SERIAL
-    sprintln("/css");
-  #endif
+  sendAsset(request, "/style.css");
+  LOGD("GET /style.css");
 }
 
 // Serve app.js
 void serveJS(AsyncWebServerRequest *request) {
-  request->send(SPIFFS, "/app.js");
-  #ifdef VERBOSE_SERIAL
-    sprintln("/jscript ");
-  #endif
+  sendAsset(request, "/app.js");
+  LOGD("GET /app.js");
 }
 
-// Serve names.json
+// Serve names.json, generated from the status fields table
 void serveNames(AsyncWebServerRequest *request) {
-  request->send(SPIFFS, "/names.json");
-  #ifdef VERBOSE_SERIAL
-    sprintln("/names.json ");
-  #endif
+  sendNames(request);
+  LOGD("GET /names.json");
+}
+
+// Serve /api/history: the points of one field, or the history layout and
+// memory use without a field parameter
+void serveHistory(AsyncWebServerRequest *request) {
+  if (!request->hasParam("field")) {
+    request->send(request->beginChunkedResponse("application/json",
+      [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        JsonWriter w((char *)buffer, maxLen, index);
+        historyInfoJson(w);
+        return w.length();
+      }));
+    return;
+  }
+
+  long from = request->hasParam("from") ? request->getParam("from")->value().toInt() : 0;
+  long res = request->hasParam("res") ? request->getParam("res")->value().toInt() : -1;
+
+  HistoryQuery query;
+  if (!historyQuery(query, request->getParam("field")->value().c_str(), from, res)) {
+    request->send(400, "text/plain", "Unknown field or resolution");
+    return;
+  }
+
+  // The query is the state of the response, copied into the callback
+  request->send(request->beginChunkedResponse("application/json",
+    [query](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return historyRead(query, (char *)buffer, maxLen);
+    }));
+  LOGD("GET /api/history");
+}
+
+// Serve /api/log: the sample log records after seq since, streamed from flash
+void serveLog(AsyncWebServerRequest *request) {
+  uint32_t since = request->hasParam("since") ? request->getParam("since")->value().toInt() : 0;
+
+  SampleLogQuery query;
+  sampleLogQuery(query, since);
+
+  request->send(request->beginChunkedResponse("application/json",
+    [query](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return sampleLogRead(query, (char *)buffer, maxLen);
+    }));
+  LOGD("GET /api/log");
+}
+
+// Serve /metrics in Prometheus text format, one metric family per step
+void serveMetrics(AsyncWebServerRequest *request) {
+  MetricsQuery query;
+  metricsQuery(query);
+
+  request->send(request->beginChunkedResponse("text/plain; version=0.0.4",
+    [query](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return metricsRead(query, (char *)buffer, maxLen);
+    }));
+  LOGD("GET /metrics");
+}
+
+// Serve /api/loglevel: the level of each log module. With module (or "all")
+// and level parameters, set it first.
+void serveLogLevel(AsyncWebServerRequest *request) {
+  if (request->hasParam("module") || request->hasParam("level")) {
+    if (!request->hasParam("module") || !request->hasParam("level") ||
+        !logSetLevel(request->getParam("module")->value().c_str(), request->getParam("level")->value().c_str())) {
+      request->send(400, "text/plain", "Unknown module or level");
+      return;
+    }
+    LOGI("Log level of %s set to %s", request->getParam("module")->value().c_str(),
+         request->getParam("level")->value().c_str());
+  }
+
+  // Rendered from the copy, every chunk sees the same numbers
+  struct LogReport {
+    uint8_t levels[LOG_MODULES];
+    LogStats stats;
+  } report;
+  for (uint8_t m = 0; m < LOG_MODULES; m++) {
+    report.levels[m] = log_levels[m];
+  }
+  report.stats = logStats();
+
+  request->send(request->beginChunkedResponse("application/json",
+    [report](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      const LogStats &stats = report.stats;
+      w.raw('{');
+      w.key("levels");
+      w.raw('{');
+      for (uint8_t m = 0; m < LOG_MODULES; m++) {
+        if (m) {
+          w.raw(',');
+        }
+        w.key(logModuleName(m));
+        w.str(logLevelName(report.levels[m]));
+      }
+      w.raw("},");
+      w.key("written");
+      w.u32(stats.written);
+      w.raw(',');
+      w.key("dropped");
+      w.u32(stats.dropped);
+      w.raw('}');
+      return w.length();
+    }));
+}
+
+// Serve /api/perf: latency percentiles of each profiled stage, in
+// microseconds. With reset=1, or on POST, the histograms start over once
+// read, so nothing recorded between the two is lost.
+void servePerf(AsyncWebServerRequest *request) {
+  struct PerfReport {
+    PerfSummary stages[PERF_STAGES];
+    JobStats jobs[SCHEDULERS_MAX * SCHEDULER_JOBS];
+    uint8_t jobCount;
+    uint32_t since;
+  } report;
+
+  report.since = perfSince();
+  for (uint8_t i = 0; i < PERF_STAGES; i++) {
+    perfSummary((PerfStage)i, report.stages[i]);
+  }
+  report.jobCount = Scheduler::stats(report.jobs, SCHEDULERS_MAX * SCHEDULER_JOBS);
+  if (request->method() == HTTP_POST || request->hasParam("reset")) {
+    perfReset();
+    Scheduler::resetStats();
+    LOGI("Profiler reset");
+  }
+
+  // Rendered from the copy, every chunk sees the same numbers
+  request->send(request->beginChunkedResponse("application/json",
+    [report](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      w.raw('{');
+      w.key("since");
+      w.u32(report.since);
+      w.raw(',');
+      w.key("stages");
+      w.raw('{');
+      for (uint8_t i = 0; i < PERF_STAGES; i++) {
+        const PerfSummary &s = report.stages[i];
+        if (i) {
+          w.raw(',');
+        }
+        w.key(perfStageName(i));
+        w.raw('{');
+        w.key("count");
+        w.u32(s.count);
+        w.raw(',');
+        w.key("mean");
+        w.u32(s.mean);
+        w.raw(',');
+        w.key("p50");
+        w.u32(s.p50);
+        w.raw(',');
+        w.key("p95");
+        w.u32(s.p95);
+        w.raw(',');
+        w.key("p99");
+        w.u32(s.p99);
+        w.raw(',');
+        w.key("max");
+        w.u32(s.max);
+        w.raw('}');
+      }
+      w.raw("},");
+
+      // Timed jobs, the one-shots still pending included
+      w.key("jobs");
+      w.raw('[');
+      for (uint8_t i = 0; i < report.jobCount; i++) {
+        const JobStats &j = report.jobs[i];
+        if (i) {
+          w.raw(',');
+        }
+        w.raw('{');
+        w.key("task");
+        w.str(j.scheduler);
+        w.raw(',');
+        w.key("name");
+        w.str(j.name);
+        w.raw(',');
+        const struct {
+          const char *key;
+          uint32_t value;
+        } counters[] = {
+          {"period_ms", j.period_ms},
+          {"runs", j.runs},
+          {"overruns", j.overruns},
+          {"late_max_ms", j.late_max_ms},
+          {"run_max_ms", j.run_max_ms},
+          {"due_in_ms", j.due_in_ms},
+        };
+        for (uint8_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+          if (c) {
+            w.raw(',');
+          }
+          w.key(counters[c].key);
+          w.u32(counters[c].value);
+        }
+        w.raw('}');
+      }
+      w.raw("]}");
+      return w.length();
+    }));
+  LOGD("GET /api/perf");
+}
+
+// Serve /api/modbus: link quality counters since boot or the last reset.
+// With reset=1, or on POST, they start over once read.
+void serveModbus(AsyncWebServerRequest *request) {
+  std::shared_ptr<ModbusLinkStats> stats = std::make_shared<ModbusLinkStats>();
+  mbus.stats(*stats);
+  uint8_t chunkSize = chunk_size;
+  uint8_t chunkSizeMax = chunk_size_max;
+  WatchdogStats watchdog;
+  watchdogStats(watchdog);
+  std::shared_ptr<ReadIntervalStats> interval = std::make_shared<ReadIntervalStats>();
+  readIntervalStats(*interval);
+  if (request->method() == HTTP_POST || request->hasParam("reset")) {
+    mbus.resetStats();
+    watchdogReset();
+    LOGI("Modbus link stats reset");
+  }
+
+  // Rendered from the copy, every chunk sees the same numbers
+  request->send(request->beginChunkedResponse("application/json",
+    [stats, chunkSize, chunkSizeMax, watchdog, interval](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      modbusJson(w, *stats, chunkSize, chunkSizeMax, watchdog, *interval);
+      return w.length();
+    }));
+  LOGD("GET /api/modbus");
+}
+
+// Serve /api/events: the events still in the ring, oldest first. With
+// since=N only the ones after event id N.
+void serveEvents(AsyncWebServerRequest *request) {
+  uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), NULL, 10) : 0;
+
+  std::shared_ptr<std::vector<Event>> list = std::make_shared<std::vector<Event>>();
+  list->reserve(EVENT_RING_SIZE);
+  Event e;
+  while (list->size() < EVENT_RING_SIZE && eventRead(since, e)) {
+    list->push_back(e);
+    since = e.id;
+  }
+  uint32_t latest = eventsLatest();
+
+  request->send(request->beginChunkedResponse("application/json",
+    [list, latest](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      w.raw('{');
+      w.key("latest");
+      w.u32(latest);
+      w.raw(',');
+      w.key("events");
+      w.raw('[');
+      for (size_t i = 0; i < list->size(); i++) {
+        if (i) {
+          w.raw(',');
+        }
+        eventJson(w, (*list)[i]);
+      }
+      w.raw("]}");
+      return w.length();
+    }));
+  LOGD("GET /api/events");
+}
+
+// Serve /api/settings: the writable settings and the writes still in the
+// ring. A POST with key and value queues a write and answers 202 with it;
+// id=N then follows that write until it is done.
+void serveSettings(AsyncWebServerRequest *request) {
+  char json[192];
+
+  if (request->method() == HTTP_POST) {
+    if (!request->hasParam("key") || !request->hasParam("value")) {
+      request->send(400, "text/plain", "key and value required");
+      return;
+    }
+
+    const char *key = request->getParam("key")->value().c_str();
+    const char *text = request->getParam("value")->value().c_str();
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+    if (!*text || *end || value > 0xFFFF) {
+      request->send(400, "text/plain", "Bad value");
+      return;
+    }
+
+    uint32_t id = 0;
+    switch (settingWrite(key, value, id)) {
+      case SUBMIT_UNKNOWN:
+        request->send(404, "text/plain", "Unknown setting");
+        return;
+      case SUBMIT_RANGE:
+        request->send(400, "text/plain", "Value out of range");
+        return;
+      case SUBMIT_RATE_LIMITED:
+        request->send(429, "text/plain", "Setting written too recently");
+        return;
+      case SUBMIT_FULL:
+        request->send(503, "text/plain", "Too many writes pending");
+        return;
+      default:
+        break;
+    }
+
+    SettingWrite job;
+    settingWriteStatus(id, job);
+    JsonWriter w(json, sizeof(json) - 1);
+    settingWriteJson(w, job);
+    json[w.length()] = 0;
+    request->send(202, "application/json", json);
+    return;
+  }
+
+  if (request->hasParam("id")) {
+    SettingWrite job;
+    if (!settingWriteStatus(strtoul(request->getParam("id")->value().c_str(), NULL, 10), job)) {
+      request->send(404, "text/plain", "Unknown write");
+      return;
+    }
+    JsonWriter w(json, sizeof(json) - 1);
+    settingWriteJson(w, job);
+    json[w.length()] = 0;
+    request->send(200, "application/json", json);
+    return;
+  }
+
+  // Newest first
+  std::shared_ptr<std::vector<SettingWrite>> writes = std::make_shared<std::vector<SettingWrite>>();
+  writes->reserve(SETTING_WRITE_JOBS);
+  SettingWrite job;
+  for (uint32_t id = settingWritesLatest(); id && settingWriteStatus(id, job); id--) {
+    writes->push_back(job);
+  }
+
+  request->send(request->beginChunkedResponse("application/json",
+    [writes](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      JsonWriter w((char *)buffer, maxLen, index);
+      settingsJson(w, writes->data(), writes->size());
+      return w.length();
+    }));
+  LOGD("GET /api/settings");
+}
+
+// Send the current sample to a client that just (re)connected to
+// /api/stream, runs in the AsyncTCP task like the other handlers
+void streamConnect(AsyncEventSourceClient *client) {
+  size_t len;
+  const char *etag;
+  const char *payload = statusPayload(STATUS_JSON, len, etag);
+
+  if (len) {
+    client->send(payload, "status", snapshotSeq(), STREAM_RETRY_MS);
+  }
+  LOGD("/api/stream client connected");
 }
 
 // Initialize web server
@@ -71,25 +473,82 @@ void webserverSetup() {
   server.on("/style.css", HTTP_GET, serveCSS);
   server.on("/app.js", HTTP_GET, serveJS);
   server.on("/api/status", HTTP_GET, serveStatus);
+  server.on("/api/status.cbor", HTTP_GET, serveStatusCbor);
+  server.on("/api/fields", HTTP_GET, serveFields);
+  server.on("/api/history", HTTP_GET, serveHistory);
+  server.on("/api/log", HTTP_GET, serveLog);
+  server.on("/api/loglevel", HTTP_GET | HTTP_POST, serveLogLevel);
+  server.on("/api/perf", HTTP_GET | HTTP_POST, servePerf);
+  server.on("/api/modbus", HTTP_GET | HTTP_POST, serveModbus);
+  server.on("/api/events", HTTP_GET, serveEvents);
+  server.on("/api/settings", HTTP_GET | HTTP_POST, serveSettings);
+  server.on("/metrics", HTTP_GET, serveMetrics);
   server.on("/names.json", HTTP_GET, serveNames);
 
+  events.onConnect(streamConnect);
+  server.addHandler(&events);
+
   #ifdef WEBSERIAL
     WebSerial.begin(&server);
     
+    // "log <module|all> <level>" changes a log level from the console
     WebSerial.onMessage([&](uint8_t *data, size_t len) {
-      Serial.printf("Received %u bytes from WebSerial: ", len);
-      Serial.write(data, len);
-      Serial.println();
-      WebSerial.println("Received Data...");
-      String d = "";
-      for(size_t i=0; i < len; i++){
-        d += char(data[i]);
+      char line[64];
+      len = min(len, sizeof(line) - 1);
+      memcpy(line, data, len);
+      line[len] = 0;
+
+      char module[16], level[16];
+      if (sscanf(line, "log %15s %15s", module, level) == 2) {
+        if (logSetLevel(module, level)) {
+          LOGI("Log level of %s set to %s", module, level);
+        } else {
+          LOGW("Unknown log module or level: %s %s", module, level);
+        }
+      } else {
+        LOGI("Received from WebSerial: %s (try: log <module|all> <off|error|warn|info|debug>)", line);
       }
-      WebSerial.println(d);
     });
 
-    sprintln("WebSerial Setup");
+    LOGI("WebSerial Setup");
   #endif
 
   server.begin();
 }
+
+// Push each sample once to /api/stream. Serialized into a buffer of its own:
+// the statusPayload() cache belongs to the AsyncTCP task.
+void webserverLoop() {
+  static uint32_t lastSeq = 0;
+  static uint32_t lastEvent = 0;
+  static char payload[STATUS_JSON_MAX];
+
+  // Events first, they are what a client waits for. No SSE id: that one
+  // is the sample seq a reconnecting client resumes from.
+  Event e;
+  while (eventRead(lastEvent, e)) {
+    lastEvent = e.id;
+    if (events.count()) {
+      JsonWriter w(payload, sizeof(payload) - 1);
+      eventJson(w, e);
+      payload[w.length()] = 0;
+      events.send(payload, "event");
+    }
+  }
+
+  uint32_t seq = snapshotSeq();
+  if (seq == lastSeq) {
+    return;
+  }
+  lastSeq = seq;
+
+  if (events.count() == 0) {
+    return;
+  }
+
+  Snapshot snap;
+  readSnapshot(snap);
+  if (statusJson(snap, payload, sizeof(payload))) {
+    events.send(payload, "status", snap.seq);
+  }
+}
@@ -10,4 +10,7 @@
 // Initialize web server
 void webserverSetup();
 
+// Push new samples to /api/stream clients, called from loop()
+void webserverLoop();
+
 #endif // WEBSERVER_H
@@ -3,19 +3,12 @@
 
 #include "wifi.h"
 #include "globals.h"
-#include "wifi_creds.h"
+#include "credentials.h"
 #include <WiFi.h>
 #include <WiFiAP.h>
+#include "log.h"
 
-// Print macros for this module
-#ifdef WEBSERIAL
-  #include <WebSerial.h>
-  #define sprint(...) WebSerial.print(__VA_ARGS__)
-  #define sprintln(...) WebSerial.println(__VA_ARGS__)
-#else
-  #define sprint(...) Serial.print(__VA_ARGS__)
-  #define sprintln(...) Serial.println(__VA_ARGS__)
-#endif
+#define LOG_MODULE LOG_WIFI
 
 // Connect to WiFi or start AP mode
 void doWifi() {
@@ -23,29 +16,27 @@ void doWifi() {
   WiFi.mode(WIFI_OFF);
   delay(50);
   WiFi.mode(WIFI_STA);
-  WiFi.begin(c_ssid, c_password);
+  WiFi.begin(wifiSsid(), wifiPassword());
 
   if (WiFi.waitForConnectResult() != WL_CONNECTED) {
-    sprintln("No Wifi Net, back to AP mode");
+    LOGW("No Wifi Net, back to AP mode");
     WiFi.disconnect();
     WiFi.mode(WIFI_OFF);
     delay(50);
     WiFi.mode(WIFI_AP);
     delay(50);
 
-    WiFi.softAP(s_ssid, s_password);
+    WiFi.softAP(apSsid(), apPassword());
     wifiMode = 1;
 
     myIp = WiFi.softAPIP();
   } else {
     myIp = WiFi.localIP();
-    sprintln("Connected to existent Wifi");
+    LOGI("Connected to existent Wifi");
     wifiMode = 0;
   }
 
-  sprintln("WiFi Ready");
-  sprint("IP address: ");
-  sprintln(myIp);
+  LOGI("WiFi Ready, IP address: %s", myIp.toString().c_str());
 }
 
 // Check WiFi connection and reconnect if needed
@@ -15,4 +15,11 @@ static const char *s_password = "Your_AP_Password";
 // Hostname for mDNS and network discovery
 static const char *hostname = "ESP32-PowMr";
 
+// MQTT broker login, empty for none
+static const char *mqtt_user = "";
+static const char *mqtt_password = "";
+
+// InfluxDB API token with write access to the bucket in INFLUX_PATH
+static const char *influx_token = "";
+
 #endif // WIFI_CREDS_H